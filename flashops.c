@@ -5,17 +5,20 @@
 #include <errno.h>
 #include <string.h>
 #include <flashops.h>
+#include <crc32.h>
 int snand_read(struct spinand_device *snand, size_t offs, size_t len,
 	       bool ecc_enabled, bool read_oob, FILE *fp)
 {
 	struct nand_device *nand = spinand_to_nand(snand);
 	size_t page_size = nanddev_page_size(nand);
 	size_t oob_size = nanddev_per_page_oobsize(nand);
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
 	size_t fwrite_size;
-	struct nand_page_io_req io_req;
+	struct nand_pos pos;
 	size_t rdlen = 0;
+	unsigned int i, npages;
+	int *results;
 	uint8_t *buf;
-	int ret;
 
 	if (offs % page_size) {
 		fprintf(stderr, "Reading should start at page boundary.\n");
@@ -25,39 +28,42 @@ int snand_read(struct spinand_device *snand, size_t offs, size_t len,
 	if (!len)
 		len = nanddev_size(nand) - offs;
 
-	buf = malloc(page_size + oob_size);
+	fwrite_size = page_size;
+	if (read_oob)
+		fwrite_size += oob_size;
+
+	buf = spinand_alloc_buf(snand, fwrite_size * ppb + sizeof(*results) * ppb);
 	if (!buf)
 		return -ENOMEM;
 
-	memset(&io_req, 0, sizeof(io_req));
-	io_req.databuf.in = buf;
-	io_req.datalen = page_size;
-	io_req.dataoffs = 0;
-	fwrite_size = page_size;
-	if (read_oob) {
-		io_req.oobbuf.in = buf + page_size;
-		io_req.ooblen = oob_size;
-		io_req.ooboffs = 0;
-		fwrite_size += oob_size;
-	}
-	nanddev_offs_to_pos(nand, offs, &io_req.pos);
+	results = (int *)(buf + fwrite_size * ppb);
+	nanddev_offs_to_pos(nand, offs, &pos);
 
 	while (rdlen < len) {
 		printf("reading offset (%lX block %u page %u)\r", offs + rdlen,
-		       io_req.pos.eraseblock, io_req.pos.page);
-		ret = spinand_read_page(snand, &io_req, ecc_enabled);
-		if (ret > 0) {
-			printf("\necc corrected %d bitflips.\n", ret);
-		} else if (ret < 0) {
-			printf("\nreading failed. errno %d\n", ret);
-			memset(buf, 0, fwrite_size);
+		       pos.eraseblock, pos.page);
+		npages = (len - rdlen + page_size - 1) / page_size;
+		if (npages > ppb - pos.page)
+			npages = ppb - pos.page;
+
+		spinand_read_pages(snand, &pos, npages, buf, read_oob,
+				   ecc_enabled, results);
+		for (i = 0; i < npages; i++) {
+			if (results[i] > 0) {
+				printf("\necc corrected %d bitflips.\n",
+				       results[i]);
+			} else if (results[i] < 0) {
+				printf("\nreading failed. errno %d\n",
+				       results[i]);
+				memset(buf + i * fwrite_size, 0, fwrite_size);
+			}
+			nanddev_pos_next_page(nand, &pos);
 		}
-		fwrite(buf, 1, fwrite_size, fp);
-		rdlen += page_size;
-		nanddev_pos_next_page(nand, &io_req.pos);
+		fwrite(buf, 1, fwrite_size * npages, fp);
+		rdlen += page_size * npages;
 	}
 	printf("\n\ndone.\n");
-	free(buf);
+	spinand_free_buf(snand, buf);
 	return 0;
 }
 
@@ -158,6 +164,346 @@ BAD_BLOCK:
 	return -EIO;
 }
 
+static size_t snand_fill_block(FILE *fp, uint8_t *buf, size_t fread_len,
+			       unsigned int ppb, unsigned int *npages,
+			       bool *eof)
+{
+	size_t actual_read_len, rd_len = 0;
+
+	for (*npages = 0; *npages < ppb && !*eof; (*npages)++) {
+		actual_read_len = fread(buf + rd_len, 1, fread_len, fp);
+		rd_len += actual_read_len;
+		if (actual_read_len < fread_len) {
+			*eof = true;
+			if (!actual_read_len)
+				break;
+			memset(buf + rd_len, 0xff, fread_len - actual_read_len);
+		}
+	}
+
+	return rd_len;
+}
+
+/*
+ * When the controller can checksum pages on its side, only their CRCs are
+ * read back, into @rdbuf, and compared to those of @buf.
+ */
+static int snand_verify_block(struct spinand_device *snand,
+			      const struct nand_pos *pos, const uint8_t *buf,
+			      uint8_t *rdbuf, unsigned int npages)
+{
+	struct nand_device *nand = spinand_to_nand(snand);
+	size_t page_size = nanddev_page_size(nand);
+	uint32_t *crcs = (uint32_t *)rdbuf;
+	unsigned int i;
+	bool by_crc;
+	int ret;
+
+	ret = spinand_read_pages_crc32(snand, pos, npages, false, true, crcs,
+				       NULL);
+	by_crc = ret != -EOPNOTSUPP;
+	if (!by_crc)
+		ret = spinand_read_pages(snand, pos, npages, rdbuf, false,
+					 true, NULL);
+	if (ret > 0) {
+		printf("\necc corrected %d bitflips.\n", ret);
+	} else if (ret < 0) {
+		printf("\nreading failed. errno %d\n", ret);
+		return ret;
+	}
+
+	for (i = 0; by_crc && i < npages; i++) {
+		if (crcs[i] != crc32(0, buf + i * page_size, page_size))
+			break;
+	}
+
+	if (by_crc ? i < npages : memcmp(buf, rdbuf, npages * page_size)) {
+		printf("\ndata verification failed.\n");
+		return -EBADMSG;
+	}
+
+	return 0;
+}
+
+/*
+ * Multi-die chips are written with one lane per die. A lane starts an erase
+ * or a page program on its die and the next lane is served while it is
+ * busy, so tBERS/tPROG of a die is hidden behind the transfers to the other
+ * ones.
+ *
+ * The image is laid out over the good blocks in order, so the file offset a
+ * lane starts at depends on the number of good blocks in the lanes before
+ * it. Bad block markers are read on first use: when a lane starts, only for
+ * the blocks before it which hold data, and for its own blocks as it
+ * reaches them. When a block fails at runtime, the lanes after it are
+ * restarted with their data shifted by one block.
+ */
+enum snand_lane_state {
+	LANE_NEXT_BLOCK,
+	LANE_ERASING,
+	LANE_PROGRAMMING,
+	LANE_DONE,
+};
+
+struct snand_lane {
+	enum snand_lane_state state;
+	unsigned int first_blk;
+	unsigned int blk;
+	unsigned int end_blk;
+	size_t data_offs;
+	unsigned int npages;
+	struct nand_page_io_req req;
+	uint8_t *buf;
+};
+
+struct snand_lanes {
+	struct spinand_device *snand;
+	FILE *fp;
+	bool ecc_enabled;
+	bool write_oob;
+	bool erase_rest;
+	size_t old_bbm_offs, old_bbm_len, bbm_offs, bbm_len;
+	size_t data_start, data_end;
+	size_t chunk;
+	unsigned int start_blk;
+	bool *bad;
+	bool *checked;
+	uint8_t *rdbuf;
+	unsigned int nlanes;
+	struct snand_lane *lanes;
+};
+
+static void snand_lane_pos(struct snand_lanes *l, unsigned int blk,
+			   struct nand_pos *pos)
+{
+	struct nand_device *nand = spinand_to_nand(l->snand);
+
+	nanddev_offs_to_pos(nand, (loff_t)blk * nanddev_eraseblock_size(nand),
+			    pos);
+}
+
+static bool snand_lane_isbad(struct snand_lanes *l, unsigned int blk)
+{
+	struct nand_pos pos;
+
+	if (!l->checked[blk]) {
+		snand_lane_pos(l, blk, &pos);
+		l->bad[blk] = snand_isbad(l->snand, &pos, l->old_bbm_offs,
+					  l->old_bbm_len);
+		l->checked[blk] = true;
+	}
+
+	return l->bad[blk];
+}
+
+/*
+ * Only the blocks until the data is covered are checked, the lane has
+ * nothing to write otherwise. Those all belong to idle lanes: either every
+ * lane when starting, or the failed lane and the ones restarted after it.
+ */
+static void snand_lane_reset(struct snand_lanes *l, unsigned int k)
+{
+	struct snand_lane *lane = &l->lanes[k];
+	unsigned int blk;
+
+	lane->data_offs = l->data_start;
+	for (blk = l->start_blk;
+	     blk < lane->first_blk && lane->data_offs < l->data_end; blk++)
+		if (!snand_lane_isbad(l, blk))
+			lane->data_offs += l->chunk;
+
+	lane->blk = lane->first_blk;
+	lane->state = LANE_NEXT_BLOCK;
+}
+
+static void snand_lane_fail(struct snand_lanes *l, unsigned int k)
+{
+	struct snand_lane *lane = &l->lanes[k];
+	unsigned int j;
+
+	snand_markbad(l->snand, &lane->req.pos, l->bbm_offs, l->bbm_len);
+	l->bad[lane->blk] = true;
+	l->checked[lane->blk] = true;
+	lane->blk++;
+	lane->state = LANE_NEXT_BLOCK;
+
+	for (j = k + 1; j < l->nlanes; j++) {
+		if (l->lanes[j].state == LANE_ERASING)
+			spinand_erase_finish(l->snand, &l->lanes[j].req.pos);
+		else if (l->lanes[j].state == LANE_PROGRAMMING)
+			spinand_write_page_finish(l->snand, &l->lanes[j].req);
+		snand_lane_reset(l, j);
+	}
+}
+
+static void snand_lane_step(struct snand_lanes *l, unsigned int k)
+{
+	struct nand_device *nand = spinand_to_nand(l->snand);
+	struct snand_lane *lane = &l->lanes[k];
+	size_t page_size = nanddev_page_size(nand);
+	size_t fread_len = l->chunk / nanddev_pages_per_eraseblock(nand);
+	size_t actual_read_len;
+	int ret;
+
+	switch (lane->state) {
+	case LANE_NEXT_BLOCK:
+		if (lane->blk >= lane->end_blk ||
+		    (lane->data_offs >= l->data_end && !l->erase_rest)) {
+			lane->state = LANE_DONE;
+			return;
+		}
+
+		snand_lane_pos(l, lane->blk, &lane->req.pos);
+		if (snand_lane_isbad(l, lane->blk)) {
+			printf("bad block: target %u block %u.\n",
+			       lane->req.pos.target, lane->req.pos.eraseblock);
+			snand_markbad(l->snand, &lane->req.pos, l->bbm_offs,
+				      l->bbm_len);
+			lane->blk++;
+			return;
+		}
+
+		printf("erasing %lX (block %u)\r",
+		       nanddev_pos_to_offs(nand, &lane->req.pos),
+		       lane->req.pos.eraseblock);
+		ret = spinand_erase_start(l->snand, &lane->req.pos);
+		if (ret) {
+			printf("erase failed: target %u block %u. ret: %d\n",
+			       lane->req.pos.target, lane->req.pos.eraseblock,
+			       ret);
+			snand_lane_fail(l, k);
+			return;
+		}
+		lane->state = LANE_ERASING;
+		return;
+	case LANE_ERASING:
+		ret = spinand_erase_finish(l->snand, &lane->req.pos);
+		if (ret) {
+			printf("erase failed: target %u block %u. ret: %d\n",
+			       lane->req.pos.target, lane->req.pos.eraseblock,
+			       ret);
+			snand_lane_fail(l, k);
+			return;
+		}
+
+		if (lane->data_offs >= l->data_end) {
+			lane->blk++;
+			lane->state = LANE_NEXT_BLOCK;
+			return;
+		}
+
+		fseek(l->fp, lane->data_offs, SEEK_SET);
+		actual_read_len = fread(lane->buf, 1, l->chunk, l->fp);
+		lane->npages = (actual_read_len + fread_len - 1) / fread_len;
+		memset(lane->buf + actual_read_len, 0xff,
+		       lane->npages * fread_len - actual_read_len);
+		printf("writing %lu bytes to %lX (block %u)\r", actual_read_len,
+		       nanddev_pos_to_offs(nand, &lane->req.pos),
+		       lane->req.pos.eraseblock);
+		if (!lane->npages) {
+			lane->data_offs = l->data_end;
+			lane->blk++;
+			lane->state = LANE_NEXT_BLOCK;
+			return;
+		}
+
+		lane->req.pos.page = 0;
+		lane->req.databuf.out = lane->buf;
+		lane->state = LANE_PROGRAMMING;
+		break;
+	case LANE_PROGRAMMING:
+		ret = spinand_write_page_finish(l->snand, &lane->req);
+		if (ret) {
+			printf("\npage writing failed.\n");
+			snand_lane_fail(l, k);
+			return;
+		}
+
+		if (lane->req.pos.page + 1 < lane->npages) {
+			lane->req.pos.page++;
+			lane->req.databuf.out = lane->buf +
+						lane->req.pos.page * fread_len;
+			break;
+		}
+
+		if (l->ecc_enabled && !l->write_oob) {
+			lane->req.pos.page = 0;
+			ret = snand_verify_block(l->snand, &lane->req.pos,
+						 lane->buf, l->rdbuf,
+						 lane->npages);
+			if (ret) {
+				snand_lane_fail(l, k);
+				return;
+			}
+		}
+
+		lane->data_offs += l->chunk;
+		lane->blk++;
+		lane->state = LANE_NEXT_BLOCK;
+		return;
+	case LANE_DONE:
+		return;
+	}
+
+	lane->req.oobbuf.out = lane->req.databuf.out + page_size;
+	ret = spinand_write_page_start(l->snand, &lane->req, l->ecc_enabled);
+	if (ret) {
+		printf("\npage writing failed.\n");
+		snand_lane_fail(l, k);
+	}
+}
+
+static int snand_write_interleaved(struct snand_lanes *l, size_t offs)
+{
+	struct nand_device *nand = spinand_to_nand(l->snand);
+	size_t eb_size = nanddev_eraseblock_size(nand);
+	unsigned int ebpt = nanddev_eraseblocks_per_target(nand);
+	unsigned int nblocks = nanddev_neraseblocks(nand);
+	unsigned int k;
+	bool active;
+	int ret = -ENOMEM;
+
+	l->start_blk = offs / eb_size;
+	l->nlanes = nanddev_ntargets(nand) - l->start_blk / ebpt;
+	l->bad = calloc(nblocks, sizeof(*l->bad));
+	l->checked = calloc(nblocks, sizeof(*l->checked));
+	l->lanes = calloc(l->nlanes, sizeof(*l->lanes));
+	l->rdbuf = spinand_alloc_buf(l->snand, l->chunk * (l->nlanes + 1));
+	if (!l->bad || !l->checked || !l->lanes || !l->rdbuf)
+		goto out;
+
+	for (k = 0; k < l->nlanes; k++) {
+		l->lanes[k].first_blk = (l->start_blk / ebpt + k) * ebpt;
+		if (l->lanes[k].first_blk < l->start_blk)
+			l->lanes[k].first_blk = l->start_blk;
+		l->lanes[k].end_blk = (l->start_blk / ebpt + k + 1) * ebpt;
+		l->lanes[k].buf = l->rdbuf + l->chunk * (k + 1);
+		l->lanes[k].req.datalen = nanddev_page_size(nand);
+		if (l->write_oob)
+			l->lanes[k].req.ooblen = nanddev_per_page_oobsize(nand);
+		snand_lane_reset(l, k);
+	}
+
+	do {
+		active = false;
+		for (k = 0; k < l->nlanes; k++) {
+			if (l->lanes[k].state == LANE_DONE)
+				continue;
+			active = true;
+			snand_lane_step(l, k);
+		}
+	} while (active);
+
+	printf("\ndone.\n");
+	ret = 0;
+out:
+	spinand_free_buf(l->snand, l->rdbuf);
+	free(l->lanes);
+	free(l->checked);
+	free(l->bad);
+	return ret;
+}
+
 int snand_write(struct spinand_device *snand, size_t offs, bool ecc_enabled,
 		bool write_oob, bool erase_rest, FILE *fp, size_t old_bbm_offs,
 		size_t old_bbm_len, size_t bbm_offs, size_t bbm_len)
@@ -167,10 +513,13 @@ int snand_write(struct spinand_device *snand, size_t offs, bool ecc_enabled,
 	size_t oob_size = nanddev_per_page_oobsize(nand);
 	size_t eb_size = nanddev_eraseblock_size(nand);
 	size_t flash_size = nanddev_size(nand);
-	size_t fread_len, actual_read_len = 0;
-	struct nand_page_io_req wr_req, rd_req;
-	size_t cur_offs = offs, eb_rd_offs = 0;
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	size_t fread_len, eb_rd_offs;
+	struct nand_pos pos;
+	size_t cur_offs = offs;
+	unsigned int npages;
 	uint8_t *buf, *rdbuf;
+	bool eof = !fp;
 	int ret;
 
 	if (offs % eb_size) {
@@ -178,99 +527,352 @@ int snand_write(struct spinand_device *snand, size_t offs, bool ecc_enabled,
 		return -EINVAL;
 	}
 
-	buf = malloc((page_size + oob_size) * 2);
-	if (!buf)
-		return -ENOMEM;
-
-	rdbuf = buf + page_size + oob_size;
-
-	memset(&wr_req, 0, sizeof(wr_req));
-	wr_req.databuf.out = buf;
-	wr_req.datalen = page_size;
-	wr_req.dataoffs = 0;
 	fread_len = page_size;
-	if (write_oob) {
-		wr_req.oobbuf.out = buf + page_size;
-		wr_req.ooblen = oob_size;
-		wr_req.ooboffs = 0;
+	if (write_oob)
 		fread_len += oob_size;
+
+	/*
+	 * Interleave the dies when the data or the erase reaches past the
+	 * first one, there is nothing to overlap otherwise.
+	 */
+	if (nanddev_ntargets(nand) > 1) {
+		struct snand_lanes l = {
+			.snand = snand,
+			.fp = fp,
+			.ecc_enabled = ecc_enabled,
+			.write_oob = write_oob,
+			.erase_rest = erase_rest,
+			.old_bbm_offs = old_bbm_offs,
+			.old_bbm_len = old_bbm_len,
+			.bbm_offs = bbm_offs,
+			.bbm_len = bbm_len,
+			.chunk = fread_len * ppb,
+		};
+		size_t target_end = (offs / nanddev_target_size(nand) + 1) *
+				    nanddev_target_size(nand);
+
+		if (fp) {
+			l.data_start = ftell(fp);
+			fseek(fp, 0, SEEK_END);
+			l.data_end = ftell(fp);
+			fseek(fp, l.data_start, SEEK_SET);
+		}
+
+		if (erase_rest || l.data_end - l.data_start >
+					  (target_end - offs) / eb_size * l.chunk)
+			return snand_write_interleaved(&l, offs);
 	}
 
-	if (fp)
-		actual_read_len = fread_len; // for the EOF check in loop.
+	buf = spinand_alloc_buf(snand, fread_len * ppb * 2);
+	if (!buf)
+		return -ENOMEM;
+
+	rdbuf = buf + fread_len * ppb;
 
-	nanddev_offs_to_pos(nand, offs, &wr_req.pos);
+	nanddev_offs_to_pos(nand, offs, &pos);
 
 	while (cur_offs < flash_size) {
-		if (!wr_req.pos.page) {
-			eb_rd_offs = 0;
-			printf("erasing %lX (block %u)\r", cur_offs,
-			       wr_req.pos.eraseblock);
-			ret = snand_erase_remark(snand, &wr_req.pos,
-						 old_bbm_offs, old_bbm_len,
-						 bbm_offs, bbm_len);
-			if (ret) {
-				printf("\nskipping current block: %d\n", ret);
-				cur_offs += eb_size;
-				nanddev_pos_next_eraseblock(nand, &wr_req.pos);
-				continue;
-			}
+		if (eof && !erase_rest)
+			break;
+
+		printf("erasing %lX (block %u)\r", cur_offs, pos.eraseblock);
+		ret = snand_erase_remark(snand, &pos, old_bbm_offs, old_bbm_len,
+					 bbm_offs, bbm_len);
+		if (ret) {
+			printf("\nskipping current block: %d\n", ret);
+			goto NEXT_BLOCK;
 		}
 
-		if (actual_read_len == fread_len) {
-			actual_read_len = fread(buf, 1, fread_len, fp);
-			printf("writing %lu bytes to %lX (block %u page %u)\r",
-			       actual_read_len, cur_offs, wr_req.pos.eraseblock,
-			       wr_req.pos.page);
-			if (actual_read_len < fread_len)
-				memset(buf + actual_read_len, 0xff,
-				       fread_len - actual_read_len);
+		if (eof)
+			goto NEXT_BLOCK;
 
-			eb_rd_offs += actual_read_len;
+		eb_rd_offs = snand_fill_block(fp, buf, fread_len, ppb, &npages,
+					      &eof);
 
-			ret = spinand_write_page(snand, &wr_req, ecc_enabled);
-			if (ret) {
-				printf("\npage writing failed.\n");
+		printf("writing %lu bytes to %lX (block %u)\r", eb_rd_offs,
+		       cur_offs, pos.eraseblock);
+
+		ret = spinand_write_pages(snand, &pos, npages, buf, write_oob,
+					  ecc_enabled);
+		if (ret) {
+			printf("\npage writing failed.\n");
+			goto BAD_BLOCK;
+		}
+
+		if (ecc_enabled && !write_oob) {
+			ret = snand_verify_block(snand, &pos, buf, rdbuf,
+						 npages);
+			if (ret)
 				goto BAD_BLOCK;
+		}
+
+	NEXT_BLOCK:
+		cur_offs += eb_size;
+		nanddev_pos_next_eraseblock(nand, &pos);
+		continue;
+	BAD_BLOCK:
+		snand_markbad(snand, &pos, bbm_offs, bbm_len);
+		fseek(fp, -eb_rd_offs, SEEK_CUR);
+		eof = false;
+		cur_offs += eb_size;
+		nanddev_pos_next_eraseblock(nand, &pos);
+	}
+	printf("\ndone.\n");
+	spinand_free_buf(snand, buf);
+	return 0;
+}
+
+/*
+ * Compare the flash content to an image laid out like the output of
+ * snand_read(). The pages are checksummed by the controller when it can,
+ * otherwise read back and checksummed here.
+ */
+int snand_verify(struct spinand_device *snand, size_t offs, bool ecc_enabled,
+		 bool read_oob, FILE *fp)
+{
+	struct nand_device *nand = spinand_to_nand(snand);
+	size_t page_size = nanddev_page_size(nand);
+	size_t flash_size = nanddev_size(nand);
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	unsigned int i, npages, nbad = 0;
+	size_t fread_len, cur_offs = offs;
+	uint8_t *buf, *rdbuf;
+	uint32_t *crcs;
+	struct nand_pos pos;
+	bool eof = false;
+	int *results;
+	int ret;
+
+	if (offs % page_size) {
+		fprintf(stderr, "Verifying should start at page boundary.\n");
+		return -EINVAL;
+	}
+
+	fread_len = page_size;
+	if (read_oob)
+		fread_len += nanddev_per_page_oobsize(nand);
+
+	buf = spinand_alloc_buf(snand, fread_len * ppb * 2 +
+					       (sizeof(*crcs) +
+						sizeof(*results)) * ppb);
+	if (!buf)
+		return -ENOMEM;
+
+	rdbuf = buf + fread_len * ppb;
+	crcs = (uint32_t *)(rdbuf + fread_len * ppb);
+	results = (int *)(crcs + ppb);
+	nanddev_offs_to_pos(nand, offs, &pos);
+
+	while (!eof && cur_offs < flash_size) {
+		printf("verifying offset (%lX block %u page %u)\r", cur_offs,
+		       pos.eraseblock, pos.page);
+		snand_fill_block(fp, buf, fread_len, ppb - pos.page, &npages,
+				 &eof);
+		if (!npages)
+			break;
+
+		for (i = 0; i < npages; i++)
+			results[i] = -EIO;
+
+		ret = spinand_read_pages_crc32(snand, &pos, npages, read_oob,
+					       ecc_enabled, crcs, results);
+		if (ret == -EOPNOTSUPP) {
+			spinand_read_pages(snand, &pos, npages, rdbuf,
+					   read_oob, ecc_enabled, results);
+			for (i = 0; i < npages; i++)
+				crcs[i] = crc32(0, rdbuf + i * fread_len,
+						fread_len);
+		}
+
+		for (i = 0; i < npages; i++) {
+			if (results[i] > 0) {
+				printf("\necc corrected %d bitflips.\n",
+				       results[i]);
+			} else if (results[i] < 0) {
+				printf("\nreading %lX failed. errno %d\n",
+				       cur_offs, results[i]);
+				nbad++;
 			}
 
-			if (ecc_enabled && !write_oob) {
-				rd_req = wr_req;
-				rd_req.databuf.out = rdbuf;
-				rd_req.oobbuf.out = rdbuf + page_size;
-				ret = spinand_read_page(snand, &rd_req,
-							ecc_enabled);
-				if (ret > 0) {
-					printf("\necc corrected %d bitflips.\n",
-					       ret);
-				} else if (ret < 0) {
-					printf("\nreading failed. errno %d\n",
-					       ret);
-					goto BAD_BLOCK;
-				}
-				if (memcmp(buf, rdbuf, fread_len)) {
-					printf("\ndata verification failed.\n");
-					goto BAD_BLOCK;
-				}
+			if (results[i] >= 0 &&
+			    crcs[i] != crc32(0, buf + i * fread_len,
+					     fread_len)) {
+				printf("\npage at %lX differs.\n", cur_offs);
+				nbad++;
 			}
+
 			cur_offs += page_size;
-			nanddev_pos_next_page(nand, &wr_req.pos);
-		} else if (erase_rest) {
-			nanddev_pos_next_eraseblock(nand, &wr_req.pos);
-			cur_offs = nanddev_pos_to_offs(nand, &wr_req.pos);
-		} else {
+			nanddev_pos_next_page(nand, &pos);
+		}
+	}
+
+	if (!eof && cur_offs >= flash_size && fgetc(fp) != EOF) {
+		printf("\nimage is larger than the flash.\n");
+		nbad++;
+	}
+
+	if (nbad)
+		printf("\n\nverification failed: %u errors.\n", nbad);
+	else
+		printf("\n\nverification passed.\n");
+
+	spinand_free_buf(snand, buf);
+	return nbad ? -EBADMSG : 0;
+}
+
+/*
+ * Only a program failure reported by the chip returns -EREMOTEIO, so that
+ * source and transfer errors don't get the destination block marked bad.
+ */
+static int snand_copy_block(struct spinand_device *snand,
+			    const struct nand_pos *src,
+			    const struct nand_pos *dst, bool ecc_enabled,
+			    uint8_t *buf)
+{
+	struct nand_device *nand = spinand_to_nand(snand);
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	struct nand_page_io_req rd_req, wr_req;
+	int ret, max_bitflips = 0;
+
+	if (spinand_copy_possible(snand, src, dst))
+		return spinand_copy_block(snand, src, dst, ecc_enabled);
+
+	/* Different plane or die: bounce the data through the host. */
+	memset(&rd_req, 0, sizeof(rd_req));
+	rd_req.pos = *src;
+	rd_req.databuf.in = buf;
+	rd_req.datalen = nanddev_page_size(nand);
+	rd_req.oobbuf.in = buf + nanddev_page_size(nand);
+	rd_req.ooblen = nanddev_per_page_oobsize(nand);
+	wr_req = rd_req;
+	wr_req.pos = *dst;
+
+	for (rd_req.pos.page = 0; rd_req.pos.page < ppb; rd_req.pos.page++) {
+		ret = spinand_read_page(snand, &rd_req, ecc_enabled);
+		if (ret < 0)
+			return ret;
+
+		if (ret > max_bitflips)
+			max_bitflips = ret;
+
+		wr_req.pos.page = rd_req.pos.page;
+		ret = spinand_write_page(snand, &wr_req, ecc_enabled);
+		if (ret)
+			return ret;
+	}
+
+	return max_bitflips;
+}
+
+int snand_copy(struct spinand_device *snand, size_t offs, size_t dst_offs,
+	       size_t len, bool ecc_enabled)
+{
+	struct nand_device *nand = spinand_to_nand(snand);
+	size_t eb_size = nanddev_eraseblock_size(nand);
+	size_t flash_size = nanddev_size(nand);
+	size_t cur_offs = offs, cur_dst_offs = dst_offs;
+	size_t dst_end = flash_size;
+	unsigned int ngood = 0;
+	struct nand_pos src, dst;
+	uint8_t *buf;
+	int ret = 0;
+
+	if (offs % eb_size || dst_offs % eb_size) {
+		fprintf(stderr, "Copying should start at eb boundary.\n");
+		return -EINVAL;
+	}
+
+	if (!len)
+		len = eb_size;
+
+	if (offs + len > flash_size || dst_offs + len > flash_size ||
+	    (dst_offs < offs + len && offs < dst_offs + len)) {
+		fprintf(stderr, "Invalid copy range.\n");
+		return -EINVAL;
+	}
+
+	/*
+	 * Bad destination blocks push the copy further, which must never
+	 * reach the source. Check upfront that the good blocks before the
+	 * limit can take the good source blocks, nothing is erased otherwise.
+	 */
+	if (dst_offs < offs)
+		dst_end = offs;
+
+	for (; cur_offs < offs + len; cur_offs += eb_size) {
+		nanddev_offs_to_pos(nand, cur_offs, &src);
+		if (!snand_isbad(snand, &src, 0, 0))
+			ngood++;
+	}
+
+	for (; ngood; cur_dst_offs += eb_size) {
+		if (cur_dst_offs >= dst_end) {
+			fprintf(stderr,
+				"Not enough good blocks at destination.\n");
+			return -ENOSPC;
+		}
+
+		nanddev_offs_to_pos(nand, cur_dst_offs, &dst);
+		if (!snand_isbad(snand, &dst, 0, 0))
+			ngood--;
+	}
+
+	cur_offs = offs;
+	cur_dst_offs = dst_offs;
+
+	buf = spinand_alloc_buf(snand, nanddev_page_size(nand) +
+					       nanddev_per_page_oobsize(nand));
+	if (!buf)
+		return -ENOMEM;
+
+	nanddev_offs_to_pos(nand, offs, &src);
+	nanddev_offs_to_pos(nand, dst_offs, &dst);
+
+	while (cur_offs < offs + len) {
+		if (snand_isbad(snand, &src, 0, 0)) {
+			printf("\nskipping bad source block %u.\n",
+			       src.eraseblock);
+			cur_offs += eb_size;
+			nanddev_pos_next_eraseblock(nand, &src);
+			continue;
+		}
+
+		if (cur_dst_offs >= dst_end) {
+			printf("\nno space left at destination.\n");
+			ret = -ENOSPC;
 			break;
 		}
 
-		continue;
-	BAD_BLOCK:
-		snand_markbad(snand, &wr_req.pos, bbm_offs, bbm_len);
-		fseek(fp, -eb_rd_offs, SEEK_CUR);
-		nanddev_pos_next_eraseblock(nand, &wr_req.pos);
-		cur_offs = nanddev_pos_to_offs(nand, &wr_req.pos);
+		printf("copying block %u to block %u\r", src.eraseblock,
+		       dst.eraseblock);
+		ret = snand_erase_remark(snand, &dst, 0, 0, 0, 0);
+		if (ret) {
+			printf("\nskipping current block: %d\n", ret);
+			goto NEXT_DST;
+		}
+
+		ret = snand_copy_block(snand, &src, &dst, ecc_enabled, buf);
+		if (ret == -EREMOTEIO) {
+			printf("\npage writing failed.\n");
+			snand_markbad(snand, &dst, 0, 0);
+			goto NEXT_DST;
+		} else if (ret < 0) {
+			printf("\ncopying failed. errno %d\n", ret);
+			break;
+		} else if (ret > 0) {
+			printf("\necc corrected %d bitflips.\n", ret);
+		}
+
+		ret = 0;
+		cur_offs += eb_size;
+		nanddev_pos_next_eraseblock(nand, &src);
+	NEXT_DST:
+		cur_dst_offs += eb_size;
+		nanddev_pos_next_eraseblock(nand, &dst);
 	}
 	printf("\ndone.\n");
-	return 0;
+	spinand_free_buf(snand, buf);
+	return ret;
 }
 
 void snand_scan_bbm(struct spinand_device *snand)
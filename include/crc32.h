@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 as computed by zlib (IEEE 802.3 polynomial, reflected). Pass 0 to
+ * start, or the CRC of the previous data to continue it.
+ */
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
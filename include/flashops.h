@@ -7,3 +7,7 @@ void snand_scan_bbm(struct spinand_device *snand);
 int snand_write(struct spinand_device *snand, size_t offs, bool ecc_enabled,
 		bool write_oob, bool erase_rest, FILE *fp, size_t old_bbm_offs,
 		size_t old_bbm_len, size_t bbm_offs, size_t bbm_len);
+int snand_verify(struct spinand_device *snand, size_t offs, bool ecc_enabled,
+		 bool read_oob, FILE *fp);
+int snand_copy(struct spinand_device *snand, size_t offs, size_t dst_offs,
+	       size_t len, bool ecc_enabled);
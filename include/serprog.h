@@ -23,3 +23,40 @@
 #define S_CMD_O_SPIOP		0x13	/* Perform SPI operation.			*/
 #define S_CMD_S_SPI_FREQ	0x14	/* Set SPI clock frequency			*/
 #define S_CMD_S_PIN_STATE	0x15	/* Enable/disable output drivers		*/
+
+/*
+ * Extensions understood by programmer firmwares made for spi-nand-prog. They
+ * are advertised in the command bitmap just like the standard commands.
+ *
+ * S_CMD_X_POLL_STATUS: <slen:1> <sbytes:slen> <mask:1> <match:1>
+ *			<timeout_ms:2>
+ *	Repeatedly sends sbytes and clocks one byte in, until
+ *	(byte & mask) == match or timeout_ms expired.
+ *	Returns ACK <matched:1> <last byte:1>.
+ */
+#define S_CMD_X_POLL_STATUS	0x30	/* Poll a status register		*/
+/*
+ * S_CMD_X_EXEC_POLL: <npre:1> <pre ops> <slen:1> <sbytes:slen> <mask:1>
+ *		      <match:1> <timeout_ms:2> <npost:1> <post ops>
+ *	Each op is encoded like the parameters of S_CMD_O_SPIOP:
+ *	<wlen:3> <rlen:3> <wbytes:wlen>. Executes the pre ops, polls the
+ *	status like S_CMD_X_POLL_STATUS and executes the post ops once it
+ *	matched, e.g. PAGE READ, wait, READ FROM CACHE on SPI-NAND.
+ *	Returns ACK <matched:1> <last byte:1>, then the bytes read by every op
+ *	in order. Post ops skipped after a timeout read as 0xff.
+ */
+#define S_CMD_X_EXEC_POLL	0x31	/* Run ops around a status poll		*/
+
+/*
+ * S_CMD_X_PAGE_CRC32: <count:2> <load op> <slen:1> <sbytes:slen> <mask:1>
+ *		       <match:1> <timeout_ms:2> <read op>
+ *	Both ops are encoded like for S_CMD_X_EXEC_POLL. The load op ends
+ *	with a big-endian address, e.g. PAGE READ and its row address. For
+ *	each of count pages, sends the load op with the address increased by
+ *	the page index, polls the status like S_CMD_X_POLL_STATUS and, once
+ *	it matched, runs the read op and computes the CRC32 (as zlib) of the
+ *	bytes it reads.
+ *	Returns ACK, then <last byte:1> <crc32:4> for each page, the CRC being
+ *	0 for pages whose status didn't match in time.
+ */
+#define S_CMD_X_PAGE_CRC32	0x32	/* CRC32 of pages read by the device	*/
@@ -75,6 +75,23 @@ enum spi_mem_data_dir {
 	SPI_MEM_DATA_OUT,
 };
 
+/* Most data segments a single operation may describe. */
+#define SPI_MEM_MAX_DATA_SEGS	8
+
+/**
+ * struct spi_mem_data_seg - one part of a scattered data buffer
+ * @buf.in: input buffer (must be DMA-able)
+ * @buf.out: output buffer (must be DMA-able)
+ * @nbytes: length of this part
+ */
+struct spi_mem_data_seg {
+	union {
+		void *in;
+		const void *out;
+	} buf;
+	unsigned int nbytes;
+};
+
 /**
  * struct spi_mem_op - describes a SPI memory operation
  * @cmd.buswidth: number of IO lines used to transmit the command
@@ -95,6 +112,11 @@ enum spi_mem_data_dir {
  *		 operation does not involve transferring data
  * @data.buf.in: input buffer (must be DMA-able)
  * @data.buf.out: output buffer (must be DMA-able)
+ * @data.segs: when @data.nsegs is not zero, the data is scattered over these
+ *	       segments, in order, instead of being in @data.buf. Only the
+ *	       first @data.nbytes bytes they describe are transferred
+ * @data.nsegs: number of entries in @data.segs, at most
+ *		SPI_MEM_MAX_DATA_SEGS
  */
 struct spi_mem_op {
 	struct {
@@ -121,6 +143,8 @@ struct spi_mem_op {
 			void *in;
 			const void *out;
 		} buf;
+		const struct spi_mem_data_seg *segs;
+		unsigned int nsegs;
 	} data;
 };
 
@@ -175,11 +199,47 @@ struct spi_mem_dirmap_desc {
 	void *priv;
 };
 
+/**
+ * struct spi_mem_async_req - operation submitted with spi_mem_submit_op()
+ * @op: copy of the operation. The buffer it points to must stay valid until
+ *	the operation completed
+ * @complete: called with the result of the operation once it completed. May
+ *	      be NULL
+ * @arg: argument passed to @complete
+ * @ret: result of the operation, valid once @done is set
+ * @done: the operation completed
+ */
+struct spi_mem_async_req {
+	struct spi_mem_op op;
+	void (*complete)(void *arg, int ret);
+	void *arg;
+	int ret;
+	bool done;
+};
+
+/**
+ * struct spi_mem_queue - operations submitted and not completed yet
+ * @reqs: ring of @depth requests
+ * @depth: most operations in flight. 0 until the queue is first used
+ * @head: index of the oldest request
+ * @count: number of requests in flight
+ */
+struct spi_mem_queue {
+	struct spi_mem_async_req *reqs;
+	unsigned int depth;
+	unsigned int head;
+	unsigned int count;
+};
+
 /**
  * struct spi_mem - describes a SPI memory device
  * @spi: the underlying SPI device
  * @drvpriv: spi_mem_driver private data
  * @name: name of the SPI memory device
+ * @data_segs: the controller handles operations whose data is scattered
+ *	       over several segments. Otherwise the core gathers such data in
+ *	       a bounce buffer before handing the operation over
+ * @queue: asynchronous operations in flight
  *
  * Extra information that describe the SPI memory device and may be needed by
  * the controller to properly handle this device should be placed here.
@@ -192,6 +252,8 @@ struct spi_mem {
 	u32 spi_mode;
 	void *drvpriv;
 	const char *name;
+	bool data_segs;
+	struct spi_mem_queue queue;
 };
 
 /**
@@ -241,6 +303,11 @@ static inline const char *spi_mem_get_name(struct spi_mem *mem)
  *		    limitations)
  * @supports_op: check if an operation is supported by the controller
  * @exec_op: execute a SPI memory operation
+ * @exec_ops: execute several SPI memory operations in a row, each one in its
+ *	      own CS cycle. This method is optional, it is meant for
+ *	      controllers able to send them all with a single transfer. It may
+ *	      return -EOPNOTSUPP for a sequence it can't handle, the operations
+ *	      are then executed one by one with ->exec_op()
  * @get_name: get a custom name for the SPI mem device from the controller.
  *	      This might be needed if the controller driver has been ported
  *	      to use the SPI mem layer and a custom name is used to keep
@@ -264,6 +331,44 @@ static inline const char *spi_mem_get_name(struct spi_mem *mem)
  *		  the currently mapped area), and the caller of
  *		  spi_mem_dirmap_write() is responsible for calling it again in
  *		  this case.
+ * @dirmap_readv: same as @dirmap_read, the data being scattered over
+ *		  several segments. This method is optional, without it only
+ *		  the first segment is transferred at a time
+ * @dirmap_writev: same as @dirmap_write, the data being gathered from
+ *		   several segments. This method is optional, without it only
+ *		   the first segment is transferred at a time
+ * @submit_op: start executing an operation without waiting for it to
+ *	       complete. This method is optional, it is meant for controllers
+ *	       able to have several transfers in flight. It may return -EBUSY
+ *	       when no more operation can be started before the oldest one
+ *	       completed
+ * @complete_op: complete the oldest operation started by ->submit_op(),
+ *		 which is passed again. Operations complete in submission
+ *		 order. When @wait is false and the operation is still in
+ *		 progress, it returns -EAGAIN. Required with ->submit_op()
+ * @poll_status: poll memory device status until (status & mask) == match or
+ *		 when the timeout has expired. It fills the data buffer of
+ *		 @op with the last status read. This method is optional, it
+ *		 is meant for controllers able to do the polling on their
+ *		 side, so that it only costs one request to the host
+ * @exec_ops_poll: execute the @pre operations, poll the status like
+ *		   ->poll_status() and execute the @post operations once it
+ *		   matched, all with a single request. This method is
+ *		   optional, it may return -EOPNOTSUPP for a sequence it can't
+ *		   handle
+ * @read_crc32: for each of @count pages, execute @load with its address
+ *		increased by the page index, poll the status like
+ *		->poll_status() and execute @read, computing the CRC32 of the
+ *		data it reads instead of transferring it. This method is
+ *		optional, it is meant for controllers able to run this on
+ *		their side, so that only the CRCs and the last status of each
+ *		page have to be sent to the host
+ * @alloc_buf: allocate a buffer for data transferred by this controller, for
+ *	       example from memory it can move data from and to without an
+ *	       extra copy. This method is optional, malloc() is used without
+ *	       it
+ * @free_buf: release a buffer returned by @alloc_buf. Required with
+ *	      @alloc_buf
  *
  * This interface should be implemented by SPI controllers providing an
  * high-level interface to execute SPI memory operation, which is usually the
@@ -281,6 +386,8 @@ struct spi_controller_mem_ops {
 			    const struct spi_mem_op *op);
 	int (*exec_op)(struct spi_mem *mem,
 		       const struct spi_mem_op *op);
+	int (*exec_ops)(struct spi_mem *mem,
+			const struct spi_mem_op *ops, unsigned int nops);
 	const char *(*get_name)(struct spi_mem *mem);
 	int (*dirmap_create)(struct spi_mem_dirmap_desc *desc);
 	void (*dirmap_destroy)(struct spi_mem_dirmap_desc *desc);
@@ -288,6 +395,35 @@ struct spi_controller_mem_ops {
 			       u64 offs, size_t len, void *buf);
 	ssize_t (*dirmap_write)(struct spi_mem_dirmap_desc *desc,
 				u64 offs, size_t len, const void *buf);
+	ssize_t (*dirmap_readv)(struct spi_mem_dirmap_desc *desc, u64 offs,
+				const struct spi_mem_data_seg *segs,
+				unsigned int nsegs);
+	ssize_t (*dirmap_writev)(struct spi_mem_dirmap_desc *desc, u64 offs,
+				 const struct spi_mem_data_seg *segs,
+				 unsigned int nsegs);
+	int (*submit_op)(struct spi_mem *mem, const struct spi_mem_op *op);
+	int (*complete_op)(struct spi_mem *mem, const struct spi_mem_op *op,
+			   bool wait);
+	int (*poll_status)(struct spi_mem *mem,
+			   const struct spi_mem_op *op,
+			   u16 mask, u16 match,
+			   unsigned long initial_delay_us,
+			   unsigned long polling_rate_us,
+			   unsigned long timeout_ms);
+	int (*exec_ops_poll)(struct spi_mem *mem,
+			     const struct spi_mem_op *pre, unsigned int npre,
+			     const struct spi_mem_op *op, u16 mask, u16 match,
+			     unsigned long timeout_ms,
+			     const struct spi_mem_op *post,
+			     unsigned int npost);
+	int (*read_crc32)(struct spi_mem *mem,
+			  const struct spi_mem_op *load, unsigned int count,
+			  const struct spi_mem_op *op, u16 mask, u16 match,
+			  unsigned long timeout_ms,
+			  const struct spi_mem_op *read, u32 *crcs,
+			  u8 *status);
+	void *(*alloc_buf)(struct spi_mem *mem, size_t len);
+	void (*free_buf)(struct spi_mem *mem, void *buf);
 };
 
 bool spi_mem_default_supports_op(struct spi_mem *mem,
@@ -298,9 +434,60 @@ int spi_mem_adjust_op_size(struct spi_mem *mem, struct spi_mem_op *op);
 bool spi_mem_supports_op(struct spi_mem *mem,
 			 const struct spi_mem_op *op);
 
+unsigned int spi_mem_data_segs_trim(const struct spi_mem_data_seg *segs,
+				    unsigned int nsegs, size_t nbytes,
+				    struct spi_mem_data_seg *out);
+
+unsigned int spi_mem_op_data_segs(const struct spi_mem_op *op,
+				  struct spi_mem_data_seg *out);
+
+void spi_mem_op_data_gather(const struct spi_mem_op *op, void *buf);
+
+void spi_mem_op_data_scatter(const struct spi_mem_op *op, const void *buf);
+
 int spi_mem_exec_op(struct spi_mem *mem,
 		    const struct spi_mem_op *op);
 
+int spi_mem_exec_ops(struct spi_mem *mem,
+		     const struct spi_mem_op *ops, unsigned int nops);
+
+int spi_mem_set_queue_depth(struct spi_mem *mem, unsigned int depth);
+
+int spi_mem_submit_op(struct spi_mem *mem, const struct spi_mem_op *op,
+		      void (*complete)(void *arg, int ret), void *arg);
+
+unsigned int spi_mem_poll(struct spi_mem *mem);
+
+int spi_mem_drain(struct spi_mem *mem);
+
+bool spi_mem_can_poll_status(struct spi_mem *mem);
+
+void *spi_mem_alloc_buf(struct spi_mem *mem, size_t len);
+
+void spi_mem_free_buf(struct spi_mem *mem, void *buf);
+
+int spi_mem_poll_status(struct spi_mem *mem,
+			const struct spi_mem_op *op,
+			u16 mask, u16 match,
+			unsigned long initial_delay_us,
+			unsigned long polling_delay_us,
+			u16 timeout_ms);
+
+bool spi_mem_can_exec_ops_poll(struct spi_mem *mem);
+
+int spi_mem_exec_ops_poll(struct spi_mem *mem,
+			  const struct spi_mem_op *pre, unsigned int npre,
+			  const struct spi_mem_op *op, u16 mask, u16 match,
+			  u16 timeout_ms, const struct spi_mem_op *post,
+			  unsigned int npost);
+
+bool spi_mem_can_read_crc32(struct spi_mem *mem);
+
+int spi_mem_read_crc32(struct spi_mem *mem, const struct spi_mem_op *load,
+		       unsigned int count, const struct spi_mem_op *op,
+		       u16 mask, u16 match, u16 timeout_ms,
+		       const struct spi_mem_op *read, u32 *crcs, u8 *status);
+
 
 
 struct spi_mem_dirmap_desc *
@@ -311,4 +498,10 @@ ssize_t spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
 			    u64 offs, size_t len, void *buf);
 ssize_t spi_mem_dirmap_write(struct spi_mem_dirmap_desc *desc,
 			     u64 offs, size_t len, const void *buf);
+ssize_t spi_mem_dirmap_readv(struct spi_mem_dirmap_desc *desc, u64 offs,
+			     const struct spi_mem_data_seg *segs,
+			     unsigned int nsegs);
+ssize_t spi_mem_dirmap_writev(struct spi_mem_dirmap_desc *desc, u64 offs,
+			      const struct spi_mem_data_seg *segs,
+			      unsigned int nsegs);
 #endif
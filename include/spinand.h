@@ -118,6 +118,18 @@
 		   SPI_MEM_OP_DUMMY(ndummy, 4),				\
 		   SPI_MEM_OP_DATA_IN(len, buf, 4))
 
+#define SPINAND_PAGE_READ_CACHE_SEQ_OP					\
+	SPI_MEM_OP(SPI_MEM_OP_CMD(0x31, 1),				\
+		   SPI_MEM_OP_NO_ADDR,					\
+		   SPI_MEM_OP_NO_DUMMY,					\
+		   SPI_MEM_OP_NO_DATA)
+
+#define SPINAND_PAGE_READ_CACHE_LAST_OP					\
+	SPI_MEM_OP(SPI_MEM_OP_CMD(0x3f, 1),				\
+		   SPI_MEM_OP_NO_ADDR,					\
+		   SPI_MEM_OP_NO_DUMMY,					\
+		   SPI_MEM_OP_NO_DATA)
+
 #define SPINAND_PROG_EXEC_OP(addr)					\
 	SPI_MEM_OP(SPI_MEM_OP_CMD(0x10, 1),				\
 		   SPI_MEM_OP_ADDR(3, addr, 1),				\
@@ -277,8 +289,52 @@ struct spinand_ecc_info {
 	int (*get_status)(struct spinand_device *spinand, u8 status);
 };
 
+/**
+ * struct spinand_op_timing - time an operation keeps the chip busy
+ * @typ_us: typical duration in microseconds
+ * @max_us: maximum duration in microseconds
+ */
+struct spinand_op_timing {
+	u32 typ_us;
+	u32 max_us;
+};
+
+/**
+ * struct spinand_timings - busy times of a SPI NAND chip, as given in the AC
+ *			    characteristics of its datasheet
+ * @tr: PAGE READ, with on-die ECC enabled
+ * @tprog: PROGRAM EXECUTE
+ * @tbers: BLOCK ERASE
+ */
+struct spinand_timings {
+	struct spinand_op_timing tr;
+	struct spinand_op_timing tprog;
+	struct spinand_op_timing tbers;
+};
+
+/**
+ * enum spinand_busy_op - operations after which the chip has to be polled
+ * @SPINAND_BUSY_RESET: RESET
+ * @SPINAND_BUSY_READ: PAGE READ
+ * @SPINAND_BUSY_READ_CACHE: READ PAGE CACHE SEQUENTIAL/LAST
+ * @SPINAND_BUSY_PROG: PROGRAM EXECUTE
+ * @SPINAND_BUSY_ERASE: BLOCK ERASE
+ * @SPINAND_NUM_BUSY_OPS: number of busy operations
+ */
+enum spinand_busy_op {
+	SPINAND_BUSY_RESET,
+	SPINAND_BUSY_READ,
+	SPINAND_BUSY_READ_CACHE,
+	SPINAND_BUSY_PROG,
+	SPINAND_BUSY_ERASE,
+	SPINAND_NUM_BUSY_OPS,
+};
+
 #define SPINAND_HAS_QE_BIT		BIT(0)
 #define SPINAND_HAS_CR_FEAT_BIT		BIT(1)
+#define SPINAND_HAS_READ_CACHE_SEQ	BIT(2)
+#define SPINAND_HAS_PROG_LOAD_RESET	BIT(3)
+#define SPINAND_HAS_CONT_STATUS		BIT(4)
 
 /**
  * struct spinand_info - Structure used to describe SPI NAND chips
@@ -294,6 +350,10 @@ struct spinand_ecc_info {
  * @op_variants.update_cache: variants of the update-cache operation
  * @select_target: function used to select a target/die. Required only for
  *		   multi-die chips
+ * @set_cont_read: enable/disable the continuous read mode. Only for chips
+ *		   able to stream consecutive pages out of a single READ FROM
+ *		   CACHE
+ * @timings: busy times of the chip. Generic defaults are used when left empty
  *
  * Each SPI NAND manufacturer driver should have a spinand_info table
  * describing all the chips supported by the driver.
@@ -312,6 +372,8 @@ struct spinand_info {
 	} op_variants;
 	int (*select_target)(struct spinand_device *spinand,
 			     unsigned int target);
+	int (*set_cont_read)(struct spinand_device *spinand, bool enable);
+	struct spinand_timings timings;
 };
 
 #define SPINAND_ID(__method, ...)					\
@@ -333,9 +395,20 @@ struct spinand_info {
 		.get_status = __get_status,				\
 	}
 
+#define SPINAND_TIMINGS(__tr, __tr_max, __tprog, __tprog_max,		\
+			__tbers, __tbers_max)				\
+	.timings = {							\
+		.tr = { __tr, __tr_max },				\
+		.tprog = { __tprog, __tprog_max },			\
+		.tbers = { __tbers, __tbers_max },			\
+	}
+
 #define SPINAND_SELECT_TARGET(__func)					\
 	.select_target = __func,
 
+#define SPINAND_CONT_READ(__func)					\
+	.set_cont_read = __func,
+
 #define SPINAND_INFO(__model, __id, __memorg, __eccreq, __op_variants,	\
 		     __flags, ...)					\
 	{								\
@@ -348,8 +421,11 @@ struct spinand_info {
 		__VA_ARGS__						\
 	}
 
+struct spinand_op_batch;
+
 struct spinand_dirmap {
 	struct spi_mem_dirmap_desc *wdesc;
+	struct spi_mem_dirmap_desc *wdesc_reset;
 	struct spi_mem_dirmap_desc *rdesc;
 };
 
@@ -367,6 +443,23 @@ struct spinand_dirmap {
  *		   a command addressing a page or an eraseblock embedded in
  *		   this die. Only required if your chip exposes several dies
  * @cur_target: currently selected target/die
+ * @set_cont_read: enable/disable the continuous read mode. Only set for chips
+ *		   supporting it
+ * @seq_read: state of an ongoing sequential cache read
+ * @seq_read.active: a READ PAGE CACHE SEQUENTIAL is in flight and the page
+ *		     at @seq_read.pos is being loaded into the data register
+ * @seq_read.ecc_enabled: on-die ECC state the sequence was started with
+ * @seq_read.pos: the page which will land in the cache next
+ * @batch: operations queued to be sent at once, NULL when they are executed
+ *	   right away
+ * @busy: model of the busy operations, used by spinand_wait() to sleep
+ *	  until the chip is expected to be ready instead of polling it
+ * @busy.timing: typical and maximum busy time. The maximum, plus some slack
+ *		 for the host side, is used as timeout
+ * @busy.est_us: expected busy time, refined with every completion observed
+ * @busy_state: operation in progress, one entry per die
+ * @busy_state.op: the last busy operation issued on the die
+ * @busy_state.start_us: when it was issued, on the CLOCK_MONOTONIC time base
  * @eccinfo: on-die ECC information
  * @cfg_cache: config register cache. One entry per die
  * @databuf: bounce buffer for data
@@ -396,6 +489,26 @@ struct spinand_device {
 			     unsigned int target);
 	unsigned int cur_target;
 
+	int (*set_cont_read)(struct spinand_device *spinand, bool enable);
+
+	struct {
+		bool active;
+		bool ecc_enabled;
+		struct nand_pos pos;
+	} seq_read;
+
+	struct spinand_op_batch *batch;
+
+	struct {
+		struct spinand_op_timing timing;
+		u32 est_us;
+	} busy[SPINAND_NUM_BUSY_OPS];
+
+	struct {
+		enum spinand_busy_op op;
+		u64 start_us;
+	} *busy_state;
+
 	struct spinand_ecc_info eccinfo;
 
 	u8 *cfg_cache;
@@ -441,10 +554,48 @@ int spinand_select_target(struct spinand_device *spinand, unsigned int target);
 int spinand_read_page(struct spinand_device *spinand,
 			     const struct nand_page_io_req *req,
 			     bool ecc_enabled);
+int spinand_read_page_seq(struct spinand_device *spinand,
+			  const struct nand_page_io_req *req, bool ecc_enabled,
+			  const struct nand_pos *next);
+bool spinand_cont_read_possible(struct spinand_device *spinand);
+int spinand_read_cont(struct spinand_device *spinand,
+		      const struct nand_pos *pos, unsigned int npages,
+		      void *buf, bool ecc_enabled);
+int spinand_read_pages(struct spinand_device *spinand,
+		       const struct nand_pos *pos, unsigned int npages,
+		       void *buf, bool read_oob, bool ecc_enabled,
+		       int *results);
+int spinand_read_pages_crc32(struct spinand_device *spinand,
+			     const struct nand_pos *pos, unsigned int npages,
+			     bool read_oob, bool ecc_enabled, u32 *crcs,
+			     int *results);
+int spinand_write_page_start(struct spinand_device *spinand,
+			     const struct nand_page_io_req *req,
+			     bool ecc_enabled);
+int spinand_write_page_finish(struct spinand_device *spinand,
+			      const struct nand_page_io_req *req);
 int spinand_write_page(struct spinand_device *spinand,
 		       const struct nand_page_io_req *req, bool ecc_enabled);
+int spinand_write_pages(struct spinand_device *spinand,
+			const struct nand_pos *pos, unsigned int npages,
+			const void *buf, bool write_oob, bool ecc_enabled);
+int spinand_erase_start(struct spinand_device *spinand,
+			const struct nand_pos *pos);
+int spinand_erase_finish(struct spinand_device *spinand,
+			 const struct nand_pos *pos);
 int spinand_erase(struct spinand_device *spinand, const struct nand_pos *pos);
+bool spinand_copy_possible(struct spinand_device *spinand,
+			   const struct nand_pos *src,
+			   const struct nand_pos *dst);
+int spinand_copy_page(struct spinand_device *spinand,
+		      const struct nand_pos *src,
+		      const struct nand_page_io_req *req, bool ecc_enabled);
+int spinand_copy_block(struct spinand_device *spinand,
+		       const struct nand_pos *src, const struct nand_pos *dst,
+		       bool ecc_enabled);
 
 struct spinand_device *spinand_probe(struct spi_mem *mem);
 void spinand_remove(struct spinand_device *spinand);
+void *spinand_alloc_buf(struct spinand_device *spinand, size_t len);
+void spinand_free_buf(struct spinand_device *spinand, void *buf);
 #endif /* __LINUX_MTD_SPINAND_H */
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <libusb-1.0/libusb.h>
+
+/*
+ * Transfer buffers of a USB programmer. They are allocated from usbfs with
+ * libusb_dev_mem_alloc() where possible, so that bulk transfers from and to
+ * them skip the copy between user and kernel space, and fall back to
+ * malloc() otherwise. Freed buffers are kept for reuse until the pool is
+ * destroyed, since mapping usbfs memory is costly and its total is limited.
+ */
+struct usb_mem_buf {
+	struct usb_mem_buf *next;
+	void *buf;
+	size_t len;
+	bool dev_mem;
+	bool in_use;
+};
+
+struct usb_mem_pool {
+	libusb_device_handle *handle;
+	struct usb_mem_buf *bufs;
+};
+
+void usb_mem_pool_init(struct usb_mem_pool *pool,
+		       libusb_device_handle *handle);
+void usb_mem_pool_destroy(struct usb_mem_pool *pool);
+void *usb_mem_alloc(struct usb_mem_pool *pool, size_t len);
+void usb_mem_free(struct usb_mem_pool *pool, void *buf);
@@ -10,6 +10,7 @@ static int with_oob = 0;
 static int erase_rest = 0;
 static size_t offs = 0;
 static size_t length = 0;
+static size_t dst_offs = 0;
 static const char *drv = "ch347";
 static const char *drvarg = NULL;
 static const struct option long_opts[] = {
@@ -69,12 +70,20 @@ int main(int argc, char *argv[])
 	switch (opt) {
 	case 'r':
 	case 'w':
+	case 'v':
 		if (left_argc < 2) {
 			puts("missing filename.");
 			return -1;
 		}
 		fpath = argv[optind + 1];
 		break;
+	case 'c':
+		if (left_argc < 2) {
+			puts("missing destination offset.");
+			return -1;
+		}
+		dst_offs = strtoul(argv[optind + 1], NULL, 0);
+		break;
 	case 'e':
 	case 's':
 		break;
@@ -115,6 +124,14 @@ int main(int argc, char *argv[])
 	case 's':
 		snand_scan_bbm(snand);
 		break;
+	case 'c':
+		if (snand_copy(snand, offs, dst_offs, length, !no_ecc))
+			ret = -1;
+		break;
+	case 'v':
+		if (snand_verify(snand, offs, !no_ecc, with_oob, fp))
+			ret = -1;
+		break;
 	}
 	if (fp)
 		fclose(fp);
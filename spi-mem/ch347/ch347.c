@@ -11,80 +11,188 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 
 #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
 #error You need to convert every USB communications to little endian before this library would work.
 #endif
 
+/* Frame @tx behind the 3-byte header in pktbuf and send it as one transfer. */
 int ch347_spi_write_packet(struct ch347_priv *priv, uint8_t cmd, const void *tx, int len) {
-    uint8_t *ptr;
-    int cur_len;
     int err, transferred;
     if (len > CH347_SPI_MAX_TRX)
         return -EINVAL;
 
-    priv->tmpbuf[0] = cmd;
-    priv->tmpbuf[1] = len & 0xff;
-    priv->tmpbuf[2] = len >> 8;
-    cur_len = sizeof(priv->tmpbuf) - 3;
-    if (len < cur_len)
-        cur_len = len;
-    memcpy(priv->tmpbuf + 3, tx, cur_len);
-    err = libusb_bulk_transfer(priv->handle, CH347_EPOUT, priv->tmpbuf, cur_len + 3, &transferred, 1000);
+    priv->pktbuf[0] = cmd;
+    priv->pktbuf[1] = len & 0xff;
+    priv->pktbuf[2] = len >> 8;
+    memcpy(priv->pktbuf + 3, tx, len);
+    err = libusb_bulk_transfer(priv->handle, CH347_EPOUT, priv->pktbuf, len + 3, &transferred, 1000);
     if (err) {
         fprintf(stderr, "ch347: libusb: failed to send packet: %d\n", err);
         return err;
     }
-    if (cur_len < len) {
-        /* This discards the const qualifier. However, libusb won't be writing to it. */
-        ptr = (uint8_t *) (tx + cur_len);
-        err = libusb_bulk_transfer(priv->handle, CH347_EPOUT, ptr, len - cur_len, &transferred, 1000);
-        if (err) {
-            fprintf(stderr, "ch347: libusb: failed to send packet: %d\n", err);
-            return err;
-        }
-    }
     return 0;
 }
 
+/*
+ * Read a whole packet of up to @len bytes of payload with one transfer. It is
+ * sized to the largest packet expected, so it ends at the packet boundary
+ * whether or not the device closes it with a short packet.
+ */
 int ch347_spi_read_packet(struct ch347_priv *priv, uint8_t cmd, void *rx, int len, int *actual_len) {
-    int cur_len, rxlen, rx_received;
+    int rxlen;
     int err, transferred;
 
-    err = libusb_bulk_transfer(priv->handle, CH347_EPIN, priv->tmpbuf, sizeof(priv->tmpbuf), &transferred, 1000);
+    if (len > CH347_SPI_MAX_TRX)
+        return -EINVAL;
+
+    err = libusb_bulk_transfer(priv->handle, CH347_EPIN, priv->pktbuf, len + 3, &transferred, 1000);
     if (err) {
         fprintf(stderr, "ch347: libusb: failed to receive packet: %d\n", err);
         return err;
     }
 
-    if (priv->tmpbuf[0] != cmd) {
-        fprintf(stderr, "ch347: unexpected packet cmd: expecting 0x%02x but we got 0x%02x.\n", cmd, priv->tmpbuf[0]);
+    if (transferred < 3 || priv->pktbuf[0] != cmd) {
+        fprintf(stderr, "ch347: unexpected packet cmd: expecting 0x%02x but we got 0x%02x.\n", cmd, priv->pktbuf[0]);
         return -EINVAL;
     }
 
-    rxlen = priv->tmpbuf[1] | priv->tmpbuf[2] << 8;
+    rxlen = priv->pktbuf[1] | priv->pktbuf[2] << 8;
     if (rxlen > len) {
         fprintf(stderr, "ch347: packet too big.\n");
         return -EINVAL;
     }
+    if (rxlen != transferred - 3) {
+        fprintf(stderr, "ch347: packet truncated.\n");
+        return -EINVAL;
+    }
 
-    cur_len = transferred - 3;
-    if (rxlen < cur_len)
-        cur_len = rxlen;
-    memcpy(rx, priv->tmpbuf + 3, cur_len);
-    rx_received = cur_len;
-    while (rx_received < rxlen) {
-        /* The leftover data length is known so we don't need to deal with packet overflow using tmpbuf. */
-        err = libusb_bulk_transfer(priv->handle, CH347_EPIN, rx + rx_received, rxlen - rx_received, &transferred, 1000);
-        if (err) {
-            fprintf(stderr, "ch347: libusb: failed to receive packet: %d\n", err);
-            return err;
-        }
-        rx_received += transferred;
+    memcpy(rx, priv->pktbuf + 3, rxlen);
+    *actual_len = rxlen;
+    return 0;
+}
+
+static void LIBUSB_CALL ch347_urb_complete(struct libusb_transfer *xfer) {
+    struct ch347_urb *urb = xfer->user_data;
+    struct ch347_priv *priv = urb->priv;
+
+    pthread_mutex_lock(&priv->lock);
+    urb->done = true;
+    pthread_cond_broadcast(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+}
+
+static int ch347_urb_submit(struct ch347_priv *priv, struct ch347_urb *urb, unsigned char ep, int len) {
+    int err;
+
+    libusb_fill_bulk_transfer(urb->xfer, priv->handle, ep, urb->buf, len, ch347_urb_complete, urb, 1000);
+    urb->done = false;
+    err = libusb_submit_transfer(urb->xfer);
+    if (err) {
+        fprintf(stderr, "ch347: libusb: failed to submit transfer: %d\n", err);
+        return err;
+    }
+    urb->busy = true;
+    return 0;
+}
+
+static void ch347_urb_wait_done(struct ch347_priv *priv, struct ch347_urb *urb) {
+    pthread_mutex_lock(&priv->lock);
+    while (!urb->done)
+        pthread_cond_wait(&priv->cond, &priv->lock);
+    pthread_mutex_unlock(&priv->lock);
+    urb->busy = false;
+}
+
+static int ch347_urb_wait(struct ch347_priv *priv, struct ch347_urb *urb) {
+    ch347_urb_wait_done(priv, urb);
+
+    switch (urb->xfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        fprintf(stderr, "ch347: libusb: transfer timed out.\n");
+        return LIBUSB_ERROR_TIMEOUT;
+    default:
+        fprintf(stderr, "ch347: libusb: transfer failed: %d\n", urb->xfer->status);
+        return LIBUSB_ERROR_IO;
     }
+}
+
+/* Cancel everything still in flight after an error and wait until libusb lets go of it. */
+static void ch347_urbs_abort(struct ch347_priv *priv) {
+    int i;
+
+    for (i = 0; i < CH347_MAX_INFLIGHT; i++) {
+        if (priv->out_urbs[i].busy)
+            libusb_cancel_transfer(priv->out_urbs[i].xfer);
+        if (priv->in_urbs[i].busy)
+            libusb_cancel_transfer(priv->in_urbs[i].xfer);
+    }
+    for (i = 0; i < CH347_MAX_INFLIGHT; i++) {
+        if (priv->out_urbs[i].busy)
+            ch347_urb_wait_done(priv, &priv->out_urbs[i]);
+        if (priv->in_urbs[i].busy)
+            ch347_urb_wait_done(priv, &priv->in_urbs[i]);
+    }
+}
+
+static void *ch347_event_thread(void *arg) {
+    struct ch347_priv *priv = arg;
+
+    while (!priv->stop_events)
+        libusb_handle_events_completed(priv->ctx, &priv->stop_events);
+    return NULL;
+}
+
+static void ch347_free_urbs(struct ch347_priv *priv) {
+    int i;
+
+    for (i = 0; i < CH347_MAX_INFLIGHT; i++) {
+        libusb_free_transfer(priv->out_urbs[i].xfer);
+        libusb_free_transfer(priv->in_urbs[i].xfer);
+    }
+}
 
-    *actual_len = rx_received;
+static int ch347_start_events(struct ch347_priv *priv) {
+    int i;
+
+    for (i = 0; i < CH347_MAX_INFLIGHT; i++) {
+        priv->out_urbs[i].priv = priv;
+        priv->out_urbs[i].xfer = libusb_alloc_transfer(0);
+        priv->in_urbs[i].priv = priv;
+        priv->in_urbs[i].xfer = libusb_alloc_transfer(0);
+        priv->out_urbs[i].buf = usb_mem_alloc(&priv->pool, CH347_URB_SIZE);
+        priv->in_urbs[i].buf = usb_mem_alloc(&priv->pool, CH347_URB_SIZE);
+        if (!priv->out_urbs[i].xfer || !priv->in_urbs[i].xfer ||
+            !priv->out_urbs[i].buf || !priv->in_urbs[i].buf)
+            goto ERR_0;
+    }
+
+    pthread_mutex_init(&priv->lock, NULL);
+    pthread_cond_init(&priv->cond, NULL);
+    if (pthread_create(&priv->event_thread, NULL, ch347_event_thread, priv)) {
+        fprintf(stderr, "ch347: failed to start event thread.\n");
+        goto ERR_1;
+    }
     return 0;
+
+    ERR_1:
+    pthread_cond_destroy(&priv->cond);
+    pthread_mutex_destroy(&priv->lock);
+    ERR_0:
+    ch347_free_urbs(priv);
+    return -ENOMEM;
+}
+
+static void ch347_stop_events(struct ch347_priv *priv) {
+    priv->stop_events = 1;
+    libusb_interrupt_event_handler(priv->ctx);
+    pthread_join(priv->event_thread, NULL);
+    pthread_cond_destroy(&priv->cond);
+    pthread_mutex_destroy(&priv->lock);
+    ch347_free_urbs(priv);
 }
 
 int ch347_get_hw_config(struct ch347_priv *priv) {
@@ -117,17 +225,32 @@ int ch347_commit_settings(struct ch347_priv *priv) {
     return ch347_spi_read_packet(priv, CH347_CMD_SPI_INIT, &unknown_data, 1, &transferred);
 }
 
-int ch347_set_cs(struct ch347_priv *priv, int cs, int val, uint16_t autodeactive_us) {
-    uint8_t buf[10] = {};
+/* Fill the 10-byte payload of a CH347_CMD_SPI_CONTROL packet. */
+static void ch347_fill_cs(uint8_t *buf, int cs, int val, uint16_t autodeactive_us) {
     uint8_t *entry = cs ? buf + 5 : buf;
 
+    memset(buf, 0, 10);
     entry[0] = val ? 0xc0 : 0x80;
     if(autodeactive_us) {
         entry[0] |= 0x20;
         entry[3] = autodeactive_us & 0xff;
         entry[4] = autodeactive_us >> 8;
     }
+}
+
+/* Append a whole CS control packet to @buf and return its length. */
+static int ch347_put_cs(uint8_t *buf, int cs, int val, uint16_t autodeactive_us) {
+    buf[0] = CH347_CMD_SPI_CONTROL;
+    buf[1] = 10;
+    buf[2] = 0;
+    ch347_fill_cs(buf + 3, cs, val, autodeactive_us);
+    return CH347_CS_PACKET_SIZE;
+}
+
+int ch347_set_cs(struct ch347_priv *priv, int cs, int val, uint16_t autodeactive_us) {
+    uint8_t buf[10];
 
+    ch347_fill_cs(buf, cs, val, autodeactive_us);
     return ch347_spi_write_packet(priv, CH347_CMD_SPI_CONTROL, buf, 10);
 }
 
@@ -169,72 +292,212 @@ int ch347_setup_spi(struct ch347_priv *priv, int spi_mode, bool lsb_first, bool
     return ch347_commit_settings(priv);
 }
 
-static int ch347_spi_trx_full_duplex_one(struct ch347_priv *priv, void *buf, uint32_t len) {
-    int err, transferred;
+/* Wait for the reply read into @urb and check it is the one expected. */
+static int ch347_urb_reap_in(struct ch347_priv *priv, struct ch347_urb *urb) {
+    int err;
 
-    err = ch347_spi_write_packet(priv, CH347_CMD_SPI_RD_WR, buf, len);
+    err = ch347_urb_wait(priv, urb);
     if (err)
         return err;
+    if (urb->xfer->actual_length < 3 || urb->buf[0] != urb->cmd) {
+        fprintf(stderr, "ch347: unexpected packet cmd: expecting 0x%02x but we got 0x%02x.\n",
+                urb->cmd, urb->buf[0]);
+        return -EINVAL;
+    }
+    if (!urb->dst)
+        return 0;
+    if (urb->xfer->actual_length != urb->len + 3 || (urb->buf[1] | urb->buf[2] << 8) != urb->len) {
+        fprintf(stderr, "ch347: unexpected packet length.\n");
+        return -EINVAL;
+    }
+    memcpy(urb->dst, urb->buf + 3, urb->len);
+    return 0;
+}
 
-    err = ch347_spi_read_packet(priv, CH347_CMD_SPI_RD_WR, buf, len, &transferred);
-    if (err)
-        return err;
+static int ch347_urb_submit_in(struct ch347_priv *priv, struct ch347_urb *urb, uint8_t cmd, void *dst, uint32_t len) {
+    urb->cmd = cmd;
+    urb->dst = dst;
+    urb->len = len;
+    /* Size data reads to exactly one packet, they may not end with a short one. */
+    return ch347_urb_submit(priv, urb, CH347_EPIN, dst ? len + 3 : CH347_EP_PACKET_SIZE);
+}
 
-    if (transferred != len) {
-        fprintf(stderr, "ch347: not enough data received.");
+/*
+ * Run a whole transfer as one stream of packets: assert @cs (a negative @cs
+ * leaves CS alone), send @tx in BLCK_WR chunks, request every @rx segment with
+ * BLCK_RD and release CS again. The CS control and read requests ride in the
+ * same OUT transfers as the data, and the acknowledgements and read data are
+ * reaped in order with up to CH347_MAX_INFLIGHT transfers queued each way.
+ */
+int ch347_spi_xfer(struct ch347_priv *priv, int cs, const struct iovec *tx, int ntx,
+                   const struct iovec *rx, int nrx) {
+    unsigned int out_head = 0, out_tail = 0, in_head = 0, in_tail = 0;
+    uint32_t tx_left = 0, tx_off = 0, rx_off = 0;
+    int tx_idx = 0, rx_idx = 0;
+    bool first = true, last_sent = false;
+    int i, err = 0;
+
+    if (nrx > CH347_MAX_RX_SEGS)
         return -EINVAL;
+    for (i = 0; i < ntx; i++)
+        tx_left += tx[i].iov_len;
+
+    while (!last_sent || rx_idx < nrx || in_tail != in_head || out_tail != out_head) {
+        struct ch347_urb *urb;
+        uint32_t cur_len, chunk;
+        int p = 0;
+
+        if (!last_sent && out_head - out_tail < CH347_MAX_INFLIGHT && in_head - in_tail < CH347_MAX_INFLIGHT) {
+            urb = &priv->out_urbs[out_head % CH347_MAX_INFLIGHT];
+            cur_len = tx_left > CH347_SPI_MAX_TRX ? CH347_SPI_MAX_TRX : tx_left;
+            chunk = cur_len;
+
+            if (first && cs >= 0)
+                p += ch347_put_cs(urb->buf, cs, 0, 0);
+            first = false;
+            if (cur_len) {
+                urb->buf[p++] = CH347_CMD_SPI_BLCK_WR;
+                urb->buf[p++] = cur_len & 0xff;
+                urb->buf[p++] = cur_len >> 8;
+                tx_left -= cur_len;
+                while (cur_len) {
+                    uint32_t n = tx[tx_idx].iov_len - tx_off;
+
+                    if (n > cur_len)
+                        n = cur_len;
+                    memcpy(urb->buf + p, (const uint8_t *) tx[tx_idx].iov_base + tx_off, n);
+                    p += n;
+                    cur_len -= n;
+                    tx_off += n;
+                    if (tx_off == tx[tx_idx].iov_len) {
+                        tx_idx++;
+                        tx_off = 0;
+                    }
+                }
+            }
+            if (!tx_left) {
+                /* FIXME: lengths should be little endian! */
+                for (i = 0; i < nrx; i++) {
+                    uint32_t len = rx[i].iov_len;
+
+                    if (!len)
+                        continue;
+                    urb->buf[p++] = CH347_CMD_SPI_BLCK_RD;
+                    urb->buf[p++] = sizeof(len);
+                    urb->buf[p++] = 0;
+                    memcpy(urb->buf + p, &len, sizeof(len));
+                    p += sizeof(len);
+                }
+                if (cs >= 0)
+                    p += ch347_put_cs(urb->buf + p, cs, 1, 0);
+                last_sent = true;
+            }
+            if (!p)
+                continue;
+            err = ch347_urb_submit(priv, urb, CH347_EPOUT, p);
+            if (err)
+                break;
+            out_head++;
+            if (chunk) {
+                err = ch347_urb_submit_in(priv, &priv->in_urbs[in_head % CH347_MAX_INFLIGHT],
+                                          CH347_CMD_SPI_BLCK_WR, NULL, 0);
+                if (err)
+                    break;
+                in_head++;
+            }
+            continue;
+        }
+
+        if (last_sent && rx_idx < nrx && in_head - in_tail < CH347_MAX_INFLIGHT) {
+            cur_len = rx[rx_idx].iov_len - rx_off;
+            if (cur_len > CH347_SPI_MAX_TRX)
+                cur_len = CH347_SPI_MAX_TRX;
+            if (cur_len) {
+                err = ch347_urb_submit_in(priv, &priv->in_urbs[in_head % CH347_MAX_INFLIGHT], CH347_CMD_SPI_BLCK_RD,
+                                          (uint8_t *) rx[rx_idx].iov_base + rx_off, cur_len);
+                if (err)
+                    break;
+                in_head++;
+                rx_off += cur_len;
+            }
+            if (rx_off == rx[rx_idx].iov_len) {
+                rx_idx++;
+                rx_off = 0;
+            }
+            continue;
+        }
+
+        if (out_tail != out_head && (out_head - out_tail == CH347_MAX_INFLIGHT || in_tail == in_head)) {
+            err = ch347_urb_wait(priv, &priv->out_urbs[out_tail++ % CH347_MAX_INFLIGHT]);
+            if (err)
+                break;
+            continue;
+        }
+
+        err = ch347_urb_reap_in(priv, &priv->in_urbs[in_tail++ % CH347_MAX_INFLIGHT]);
+        if (err)
+            break;
     }
-    return 0;
+
+    if (err)
+        ch347_urbs_abort(priv);
+    return err;
+}
+
+/*
+ * Assert @cs, exchange @len bytes and let the device release CS on its own,
+ * with a single OUT and a single IN transfer. A negative @cs leaves CS alone.
+ */
+int ch347_spi_trx_full_duplex_cs(struct ch347_priv *priv, int cs, void *buf, uint32_t len) {
+    struct ch347_urb *out = &priv->out_urbs[0];
+    struct ch347_urb *in = &priv->in_urbs[0];
+    int p = 0, err;
+
+    if (len > CH347_SPI_MAX_TRX)
+        return -EINVAL;
+
+    if (cs >= 0)
+        p = ch347_put_cs(out->buf, cs, 0, 1);
+    out->buf[p++] = CH347_CMD_SPI_RD_WR;
+    out->buf[p++] = len & 0xff;
+    out->buf[p++] = len >> 8;
+    memcpy(out->buf + p, buf, len);
+
+    err = ch347_urb_submit(priv, out, CH347_EPOUT, p + len);
+    if (!err)
+        err = ch347_urb_submit_in(priv, in, CH347_CMD_SPI_RD_WR, buf, len);
+    if (!err)
+        err = ch347_urb_wait(priv, out);
+    if (!err)
+        err = ch347_urb_reap_in(priv, in);
+    if (err)
+        ch347_urbs_abort(priv);
+    return err;
 }
 
 int ch347_spi_trx_full_duplex(struct ch347_priv *priv, void *buf, uint32_t len) {
+    uint8_t *ptr = buf;
     int err;
     while (len > CH347_SPI_MAX_TRX) {
-        err = ch347_spi_trx_full_duplex_one(priv, buf, CH347_SPI_MAX_TRX);
+        err = ch347_spi_trx_full_duplex_cs(priv, -1, ptr, CH347_SPI_MAX_TRX);
         if (err)
             return err;
+        ptr += CH347_SPI_MAX_TRX;
         len -= CH347_SPI_MAX_TRX;
     }
-    return ch347_spi_trx_full_duplex_one(priv, buf, len);
+    return ch347_spi_trx_full_duplex_cs(priv, -1, ptr, len);
 }
 
 int ch347_spi_tx(struct ch347_priv *priv, const void *tx, uint32_t len) {
-    int err, transferred;
-    uint8_t unknown_data;
-    const void *ptr = tx;
-    while (len) {
-        int cur_len = len > CH347_SPI_MAX_TRX ? CH347_SPI_MAX_TRX : len;
-        err = ch347_spi_write_packet(priv, CH347_CMD_SPI_BLCK_WR, ptr, cur_len);
-        if (err)
-            return err;
-        err = ch347_spi_read_packet(priv, CH347_CMD_SPI_BLCK_WR, &unknown_data, 1, &transferred);
-        if (err)
-            return err;
-        ptr += cur_len;
-        len -= cur_len;
-    }
-    return 0;
+    struct iovec iov = { .iov_base = (void *) tx, .iov_len = len };
+
+    return ch347_spi_xfer(priv, -1, &iov, 1, NULL, 0);
 }
 
 int ch347_spi_rx(struct ch347_priv *priv, void *rx, uint32_t len) {
-    int err, transferred;
-    void *ptr = rx;
-    uint32_t rxlen = 0;
-    /* FIXME: len should be little endian! */
-    err = ch347_spi_write_packet(priv, CH347_CMD_SPI_BLCK_RD, &len, sizeof(len));
-    if (err)
-        return err;
-    while(rxlen < len) {
-        uint32_t cur_rx = len - rxlen;
-        if(cur_rx > CH347_SPI_MAX_TRX)
-            cur_rx = CH347_SPI_MAX_TRX;
-        err = ch347_spi_read_packet(priv, CH347_CMD_SPI_BLCK_RD, ptr, (int)cur_rx, &transferred);
-        if (err)
-            return err;
-        rxlen += transferred;
-        ptr += transferred;
-    }
-    return 0;
+    struct iovec iov = { .iov_base = rx, .iov_len = len };
+
+    return ch347_spi_xfer(priv, -1, NULL, 0, &iov, 1);
 }
 
 struct ch347_priv *ch347_open() {
@@ -266,12 +529,23 @@ struct ch347_priv *ch347_open() {
         goto ERR_2;
     }
 
-    if (ch347_get_hw_config(priv))
+    usb_mem_pool_init(&priv->pool, priv->handle);
+    priv->pktbuf = usb_mem_alloc(&priv->pool, CH347_PACKET_SIZE);
+    if (!priv->pktbuf)
         goto ERR_3;
 
+    if (ch347_start_events(priv))
+        goto ERR_3;
+
+    if (ch347_get_hw_config(priv))
+        goto ERR_4;
+
     return priv;
 
+    ERR_4:
+    ch347_stop_events(priv);
     ERR_3:
+    usb_mem_pool_destroy(&priv->pool);
     libusb_release_interface(priv->handle, CH347_SPI_IF);
     ERR_2:
     libusb_close(priv->handle);
@@ -283,6 +557,8 @@ struct ch347_priv *ch347_open() {
 }
 
 void ch347_close(struct ch347_priv *priv) {
+    ch347_stop_events(priv);
+    usb_mem_pool_destroy(&priv->pool);
     libusb_release_interface(priv->handle, CH347_SPI_IF);
     libusb_close(priv->handle);
     libusb_exit(priv->ctx);
@@ -16,7 +16,10 @@ extern "C" {
 #include <endian.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include <libusb-1.0/libusb.h>
+#include <usb-mem.h>
 
 #define CH347_SPI_VID 0x1a86
 #define CH347_SPI_PID 0x55db
@@ -27,6 +30,15 @@ extern "C" {
 #define CH347_SPI_MAX_FREQ 60000
 #define CH347_SPI_MAX_PRESCALER 7
 #define CH347_SPI_MAX_TRX 4096
+#define CH347_PACKET_SIZE (CH347_SPI_MAX_TRX + 3)
+#define CH347_EP_PACKET_SIZE 512
+/* Number of bulk transfers kept in flight on each direction. */
+#define CH347_MAX_INFLIGHT 4
+#define CH347_CS_PACKET_SIZE 13
+/* Block read requests which may follow the data of one ch347_spi_xfer(). */
+#define CH347_MAX_RX_SEGS 8
+/* One data packet plus CS control and block read requests around it. */
+#define CH347_URB_SIZE (CH347_PACKET_SIZE + 2 * CH347_CS_PACKET_SIZE + CH347_MAX_RX_SEGS * 7)
 
 /* SPI_data_direction */
 #define SPI_Direction_2Lines_FullDuplex 0x0000
@@ -91,11 +103,35 @@ struct ch347_spi_hw_config {
     uint8_t Reserved[4];
 };
 
+struct ch347_priv;
+
+struct ch347_urb {
+    struct ch347_priv *priv;
+    struct libusb_transfer *xfer;
+    bool busy;
+    bool done;
+    /* expected reply and where its data goes, for IN transfers */
+    uint8_t cmd;
+    void *dst;
+    uint32_t len;
+    uint8_t *buf; /* CH347_URB_SIZE bytes */
+};
+
 struct ch347_priv {
     struct ch347_spi_hw_config cfg;
     libusb_context *ctx;
     libusb_device_handle *handle;
-    uint8_t tmpbuf[512];
+    /* transfer buffers come from here */
+    struct usb_mem_pool pool;
+    /* framing buffer for the synchronous packets, CH347_PACKET_SIZE bytes */
+    uint8_t *pktbuf;
+    /* async transfers, completed by the event thread */
+    struct ch347_urb out_urbs[CH347_MAX_INFLIGHT];
+    struct ch347_urb in_urbs[CH347_MAX_INFLIGHT];
+    pthread_t event_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop_events;
 };
 
 struct ch347_priv *ch347_open();
@@ -116,6 +152,11 @@ int ch347_spi_tx(struct ch347_priv *priv, const void *tx, uint32_t len);
 
 int ch347_spi_rx(struct ch347_priv *priv, void *rx, uint32_t len);
 
+int ch347_spi_trx_full_duplex_cs(struct ch347_priv *priv, int cs, void *buf, uint32_t len);
+
+int ch347_spi_xfer(struct ch347_priv *priv, int cs, const struct iovec *tx, int ntx,
+                   const struct iovec *rx, int nrx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,22 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <spi.h>
 #include <spi-mem.h>
 #include "ch347.h"
 
-static int ch347_adjust_op_size(struct spi_mem *mem, struct spi_mem_op *op) {
-    size_t left_data = CH347_SPI_MAX_TRX - 1 - op->addr.nbytes - op->dummy.nbytes;
-    if (op->data.nbytes > left_data)
-        op->data.nbytes = left_data;
-    return 0;
-}
+#define CH347_MEM_OP_BUF_SIZE 16
 
-static int ch347_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op) {
-    struct ch347_priv *priv = mem->drvpriv;
-    uint8_t buf[16];
+/*
+ * Header bytes of an operation: opcode, address and dummy bytes. The data
+ * phase is appended by ch347_mem_xfer().
+ */
+static int ch347_mem_encode_hdr(const struct spi_mem_op *op, uint8_t *buf) {
     int p;
-    int i, ret;
+    int i;
 
     buf[0] = op->cmd.opcode;
 
@@ -35,48 +33,181 @@ static int ch347_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op) {
     for (i = 0; i < op->dummy.nbytes; i++)
         buf[p++] = 0;
 
-    if (sizeof(buf) - p >= op->data.nbytes) {
-        ch347_set_cs(priv, 0, 0, 1);
+    return p;
+}
+
+/*
+ * @buf holds the @p header bytes and has room for CH347_MEM_OP_BUF_SIZE.
+ * Short transfers are exchanged at once with the header, longer ones stream
+ * each data segment from or to its own buffer. The CS control packets go out
+ * together with the data, so either way an operation takes a single OUT
+ * transfer plus the replies.
+ */
+static int ch347_mem_xfer(struct ch347_priv *priv, uint8_t *buf, int p,
+                          enum spi_mem_data_dir dir,
+                          const struct spi_mem_data_seg *segs,
+                          unsigned int nsegs, size_t nbytes) {
+    struct iovec iov[SPI_MEM_MAX_DATA_SEGS + 1];
+    unsigned int i, j;
+    int ret;
+
+    if (CH347_MEM_OP_BUF_SIZE - p >= nbytes) {
         uint8_t *data_ptr = buf + p;
-        if (op->data.dir == SPI_MEM_DATA_OUT && op->data.nbytes) {
-            const uint8_t *ptr = op->data.buf.out;
-            for (i = 0; i < op->data.nbytes; i++)
-                buf[p++] = ptr[i];
-        } else if (op->data.dir == SPI_MEM_DATA_IN && op->data.nbytes) {
-            for (i = 0; i < op->data.nbytes; i++)
-                buf[p++] = 0;
+        for (i = 0; i < nsegs; i++) {
+            const uint8_t *ptr = segs[i].buf.out;
+            for (j = 0; j < segs[i].nbytes; j++)
+                buf[p++] = dir == SPI_MEM_DATA_OUT ? ptr[j] : 0;
         }
-        ret = ch347_spi_trx_full_duplex(priv, buf, p);
-        if (op->data.dir == SPI_MEM_DATA_IN && op->data.nbytes) {
-            uint8_t *ptr = op->data.buf.in;
-            for (i = 0; i < op->data.nbytes; i++)
-                ptr[i] = data_ptr[i];
+        ret = ch347_spi_trx_full_duplex_cs(priv, 0, buf, p);
+        if (!ret && dir == SPI_MEM_DATA_IN) {
+            for (i = 0; i < nsegs; i++) {
+                uint8_t *ptr = segs[i].buf.in;
+                for (j = 0; j < segs[i].nbytes; j++)
+                    ptr[j] = *data_ptr++;
+            }
         }
-    } else {
-        ch347_set_cs(priv, 0, 0, 0);
-        ret = ch347_spi_tx(priv, buf, p);
-        if (ret)
-            return ret;
-        if (op->data.dir == SPI_MEM_DATA_OUT && op->data.nbytes)
-            ret = ch347_spi_tx(priv, op->data.buf.out, op->data.nbytes);
-        else if (op->data.dir == SPI_MEM_DATA_IN && op->data.nbytes)
-            ret = ch347_spi_rx(priv, op->data.buf.in, op->data.nbytes);
-        ch347_set_cs(priv, 0, 1, 0);
+        return ret;
+    }
+
+    iov[0].iov_base = buf;
+    iov[0].iov_len = p;
+    for (i = 0; i < nsegs; i++) {
+        iov[i + 1].iov_base = dir == SPI_MEM_DATA_OUT ? (void *) segs[i].buf.out : segs[i].buf.in;
+        iov[i + 1].iov_len = segs[i].nbytes;
+    }
+    if (dir == SPI_MEM_DATA_OUT)
+        return ch347_spi_xfer(priv, 0, iov, nsegs + 1, NULL, 0);
+    return ch347_spi_xfer(priv, 0, iov, 1, iov + 1, nsegs);
+}
+
+/*
+ * There is no adjust_op_size(): ch347_mem_xfer() streams data of any length
+ * within one CS assertion, so continuous reads go out as a single operation.
+ */
+static int ch347_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op) {
+    struct ch347_priv *priv = mem->drvpriv;
+    struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
+    uint8_t buf[CH347_MEM_OP_BUF_SIZE];
+    unsigned int nsegs;
+    int p;
+
+    p = ch347_mem_encode_hdr(op, buf);
+    if (p < 0)
+        return p;
+
+    nsegs = spi_mem_op_data_segs(op, segs);
+    return ch347_mem_xfer(priv, buf, p, op->data.dir, segs, nsegs,
+                          nsegs ? op->data.nbytes : 0);
+}
+
+/* Header of the dirmap template, encoded once at creation time. */
+struct ch347_dirmap {
+    uint8_t hdr[CH347_MEM_OP_BUF_SIZE];
+    int hdr_len;
+};
+
+static int ch347_dirmap_create(struct spi_mem_dirmap_desc *desc) {
+    struct ch347_dirmap *dirmap;
+    int ret;
+
+    dirmap = malloc(sizeof(*dirmap));
+    if (!dirmap)
+        return -ENOMEM;
+
+    ret = ch347_mem_encode_hdr(&desc->info.op_tmpl, dirmap->hdr);
+    if (ret < 0) {
+        free(dirmap);
+        return ret;
     }
 
+    dirmap->hdr_len = ret;
+    desc->priv = dirmap;
+    return 0;
+}
+
+static void ch347_dirmap_destroy(struct spi_mem_dirmap_desc *desc) {
+    free(desc->priv);
+}
+
+/*
+ * The whole mapped window is transferred within one CS assertion, the data
+ * being streamed in as many packets as needed.
+ */
+static ssize_t ch347_dirmap_xferv(struct spi_mem_dirmap_desc *desc, u64 offs,
+                                  const struct spi_mem_data_seg *segs,
+                                  unsigned int nsegs) {
+    struct spi_mem_data_seg tsegs[SPI_MEM_MAX_DATA_SEGS];
+    struct ch347_dirmap *dirmap = desc->priv;
+    const struct spi_mem_op *tmpl = &desc->info.op_tmpl;
+    uint32_t addr = desc->info.offset + offs;
+    uint8_t buf[CH347_MEM_OP_BUF_SIZE];
+    size_t len = 0;
+    unsigned int i;
+    int ret;
+
+    if (offs >= desc->info.length)
+        return -EINVAL;
+
+    memcpy(buf, dirmap->hdr, dirmap->hdr_len);
+    for (i = tmpl->addr.nbytes; i; i--) {
+        buf[i] = addr & 0xff;
+        addr >>= 8;
+    }
+
+    for (i = 0; i < nsegs; i++)
+        len += segs[i].nbytes;
+    if (len > desc->info.length - offs)
+        len = desc->info.length - offs;
+    nsegs = spi_mem_data_segs_trim(segs, nsegs, len, tsegs);
+
+    ret = ch347_mem_xfer(desc->mem->drvpriv, buf, dirmap->hdr_len,
+                         tmpl->data.dir, tsegs, nsegs, len);
+    return ret ? ret : len;
+}
+
+static ssize_t ch347_dirmap_read(struct spi_mem_dirmap_desc *desc, u64 offs,
+                                 size_t len, void *buf) {
+    struct spi_mem_data_seg seg = { .buf.in = buf, .nbytes = len };
+
+    return ch347_dirmap_xferv(desc, offs, &seg, 1);
+}
+
+static ssize_t ch347_dirmap_write(struct spi_mem_dirmap_desc *desc, u64 offs,
+                                  size_t len, const void *buf) {
+    struct spi_mem_data_seg seg = { .buf.out = buf, .nbytes = len };
+
+    return ch347_dirmap_xferv(desc, offs, &seg, 1);
+}
+
+static void *ch347_alloc_buf(struct spi_mem *mem, size_t len) {
+    struct ch347_priv *priv = mem->drvpriv;
+
+    return usb_mem_alloc(&priv->pool, len);
+}
+
+static void ch347_free_buf(struct spi_mem *mem, void *buf) {
+    struct ch347_priv *priv = mem->drvpriv;
 
-    return ret;
+    usb_mem_free(&priv->pool, buf);
 }
 
 static const struct spi_controller_mem_ops ch347_mem_ops = {
-        .adjust_op_size = ch347_adjust_op_size,
         .exec_op = ch347_mem_exec_op,
+        .dirmap_create = ch347_dirmap_create,
+        .dirmap_destroy = ch347_dirmap_destroy,
+        .dirmap_read = ch347_dirmap_read,
+        .dirmap_write = ch347_dirmap_write,
+        .dirmap_readv = ch347_dirmap_xferv,
+        .dirmap_writev = ch347_dirmap_xferv,
+        .alloc_buf = ch347_alloc_buf,
+        .free_buf = ch347_free_buf,
 };
 
 static struct spi_mem ch347_mem = {
         .ops = &ch347_mem_ops,
         .spi_mode = 0,
         .name = "ch347",
+        .data_segs = true,
         .drvpriv = NULL,
 };
 
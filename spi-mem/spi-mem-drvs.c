@@ -1,5 +1,6 @@
 #include <spi-mem-drvs.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct spi_mem *spi_mem_probe(const char *drv, const char *drvarg) {
@@ -13,6 +14,9 @@ struct spi_mem *spi_mem_probe(const char *drv, const char *drvarg) {
 }
 
 void spi_mem_remove(const char *drv, struct spi_mem *mem) {
+    spi_mem_drain(mem);
+    free(mem->queue.reqs);
+    memset(&mem->queue, 0, sizeof(mem->queue));
     if (!strcmp(drv, "ch347"))
         return ch347_remove(mem);
     if (!strcmp(drv, "fx2qspi"))
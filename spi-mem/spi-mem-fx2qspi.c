@@ -1,9 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <libusb-1.0/libusb.h>
 #include <spi.h>
 #include <spi-mem.h>
+#include <usb-mem.h>
 
 #define FX2_BUF_SIZE 512
 #define FX2_VID 0x1209
@@ -17,10 +19,19 @@
 #define FX2QSPI_DUAL 0x20
 #define FX2QSPI_READ 0x10
 
-static u8 fx2_op_buffer[FX2_BUF_SIZE];
+/*
+ * Longest data phase a header can describe: its length field is 12 bits
+ * wide. It is a multiple of FX2_BUF_SIZE so that only the last segment of a
+ * longer transfer ends with a short packet.
+ */
+#define FX2QSPI_MAX_SEG 0xe00
+
+/* FX2_BUF_SIZE bytes from the pool */
+static u8 *fx2_op_buffer;
 typedef struct {
 	libusb_context *ctx;
 	libusb_device_handle *handle;
+	struct usb_mem_pool pool;
 } fx2qspi_priv;
 
 static fx2qspi_priv _priv;
@@ -47,16 +58,22 @@ static void fx2qspi_fill_op(u8 buswidth, bool is_read, u16 len, size_t *ptr)
 	fx2_op_buffer[(*ptr)++] = len & 0xff;
 }
 
-static int fx2qspi_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
+/*
+ * Encode the command, address and dummy phases of @op in fx2_op_buffer.
+ * @addr_pos is set to the offset of the address bytes.
+ */
+static size_t fx2qspi_encode_hdr(const struct spi_mem_op *op,
+				 size_t *addr_pos)
 {
 	size_t ptr = 0;
-	int i, llen, alen, ret;
-	fx2qspi_priv *priv = spi_mem_get_drvdata(mem);
+	int i;
+
 	fx2qspi_fill_op(op->cmd.buswidth, false, 1, &ptr);
 	fx2_op_buffer[ptr++] = op->cmd.opcode;
 	if (op->addr.nbytes) {
 		fx2qspi_fill_op(op->addr.buswidth, false, op->addr.nbytes,
 				&ptr);
+		*addr_pos = ptr;
 		for (i = op->addr.nbytes - 1; i >= 0; i--)
 			fx2_op_buffer[ptr++] = (op->addr.val >> (i * 8)) & 0xff;
 	}
@@ -66,48 +83,75 @@ static int fx2qspi_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 		for (i = 0; i < op->dummy.nbytes; i++)
 			fx2_op_buffer[ptr++] = 0;
 	}
-	if (op->data.nbytes) {
-		fx2qspi_fill_op(op->data.buswidth,
-				op->data.dir == SPI_MEM_DATA_IN,
-				op->data.nbytes, &ptr);
+	return ptr;
+}
+
+static int fx2qspi_read(fx2qspi_priv *priv, void *data, size_t nbytes)
+{
+	int llen, alen, ret;
+	size_t ptr = 0;
+
+	llen = nbytes;
+	while (llen) {
+		if (llen >= FX2_BUF_SIZE)
+			ret = libusb_bulk_transfer(priv->handle, FX2_EPIN,
+						   data + ptr, FX2_BUF_SIZE,
+						   &alen, 20);
+		else
+			ret = libusb_bulk_transfer(priv->handle, FX2_EPIN,
+						   fx2_op_buffer, FX2_BUF_SIZE,
+						   &alen, 20);
+		if (ret)
+			return ret;
+		if (llen < FX2_BUF_SIZE)
+			memcpy(data + ptr, fx2_op_buffer, alen);
+		ptr += alen;
+		llen -= alen;
 	}
+	return 0;
+}
 
-	ret = libusb_bulk_transfer(priv->handle, FX2_EPOUT, fx2_op_buffer, ptr,
-				   &alen, 10);
-	if (ret)
-		return ret;
+/*
+ * Send the @ptr header bytes in fx2_op_buffer followed by the data phase.
+ * The data phase is split in segments of FX2QSPI_MAX_SEG bytes, all within
+ * the same CS assertion. The headers of several read segments are sent at
+ * once, so that their data is streamed back without a round trip each.
+ */
+static int fx2qspi_xfer(fx2qspi_priv *priv, size_t ptr, u8 buswidth,
+			enum spi_mem_data_dir dir, void *data, size_t nbytes)
+{
+	bool is_read = dir == SPI_MEM_DATA_IN;
+	size_t seg, len, done = 0;
+	int alen, ret;
 
-	if (op->data.nbytes) {
-		if (op->data.dir == SPI_MEM_DATA_OUT) {
-			ret = libusb_bulk_transfer(priv->handle, FX2_EPOUT,
-						   (unsigned char *)op->data.buf.out,
-						   op->data.nbytes, &alen, 20);
-			if (ret)
-				return ret;
-		} else if (op->data.dir == SPI_MEM_DATA_IN) {
-			llen = op->data.nbytes;
-			ptr = 0;
-			while (llen) {
-				if (llen >= FX2_BUF_SIZE)
-					ret = libusb_bulk_transfer(
-						priv->handle, FX2_EPIN,
-						op->data.buf.in + ptr,
-						FX2_BUF_SIZE, &alen, 20);
-				else
-					ret = libusb_bulk_transfer(
-						priv->handle, FX2_EPIN,
-						fx2_op_buffer, FX2_BUF_SIZE,
-						&alen, 20);
-				if (ret)
-					return ret;
-				if (llen < FX2_BUF_SIZE)
-					memcpy(op->data.buf.in + ptr,
-					       fx2_op_buffer, alen);
-				ptr += alen;
-				llen -= alen;
-			}
+	do {
+		len = 0;
+		while (done + len < nbytes) {
+			seg = nbytes - done - len;
+			if (seg > FX2QSPI_MAX_SEG)
+				seg = FX2QSPI_MAX_SEG;
+			fx2qspi_fill_op(buswidth, is_read, seg, &ptr);
+			len += seg;
+			if (!is_read || ptr + 2 > FX2_BUF_SIZE)
+				break;
 		}
-	}
+
+		ret = libusb_bulk_transfer(priv->handle, FX2_EPOUT,
+					   fx2_op_buffer, ptr, &alen, 10);
+		if (ret)
+			return ret;
+		ptr = 0;
+
+		if (len && is_read)
+			ret = fx2qspi_read(priv, data + done, len);
+		else if (len)
+			ret = libusb_bulk_transfer(priv->handle, FX2_EPOUT,
+						   data + done, len, &alen,
+						   20);
+		if (ret)
+			return ret;
+		done += len;
+	} while (done < nbytes);
 
 	fx2_op_buffer[0] = 0;
 	return libusb_bulk_transfer(priv->handle, FX2_EPOUT, fx2_op_buffer, 1,
@@ -116,9 +160,116 @@ static int fx2qspi_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 		       0;
 }
 
+static int fx2qspi_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
+{
+	fx2qspi_priv *priv = spi_mem_get_drvdata(mem);
+	size_t ptr, addr_pos;
+	void *data;
+
+	ptr = fx2qspi_encode_hdr(op, &addr_pos);
+	if (op->data.dir == SPI_MEM_DATA_OUT)
+		data = (void *)op->data.buf.out;
+	else
+		data = op->data.buf.in;
+
+	return fx2qspi_xfer(priv, ptr, op->data.buswidth, op->data.dir, data,
+			    op->data.nbytes);
+}
+
+/*
+ * Headers of the dirmap template, encoded once at creation time. Only the
+ * address bytes need to be patched for each access.
+ */
+struct fx2qspi_dirmap {
+	size_t len;
+	size_t addr_pos;
+	u8 hdr[];
+};
+
+static int fx2qspi_dirmap_create(struct spi_mem_dirmap_desc *desc)
+{
+	struct fx2qspi_dirmap *dirmap;
+	size_t ptr, addr_pos;
+
+	ptr = fx2qspi_encode_hdr(&desc->info.op_tmpl, &addr_pos);
+
+	dirmap = malloc(sizeof(*dirmap) + ptr);
+	if (!dirmap)
+		return -ENOMEM;
+
+	dirmap->len = ptr;
+	dirmap->addr_pos = addr_pos;
+	memcpy(dirmap->hdr, fx2_op_buffer, ptr);
+	desc->priv = dirmap;
+	return 0;
+}
+
+static void fx2qspi_dirmap_destroy(struct spi_mem_dirmap_desc *desc)
+{
+	free(desc->priv);
+}
+
+/* The whole mapped window can be transferred with a single command. */
+static ssize_t fx2qspi_dirmap_xfer(struct spi_mem_dirmap_desc *desc,
+				   u64 offs, size_t len, void *data)
+{
+	struct fx2qspi_dirmap *dirmap = desc->priv;
+	const struct spi_mem_op *tmpl = &desc->info.op_tmpl;
+	u64 addr = desc->info.offset + offs;
+	int i, ret;
+
+	if (offs >= desc->info.length)
+		return -EINVAL;
+
+	if (len > desc->info.length - offs)
+		len = desc->info.length - offs;
+
+	memcpy(fx2_op_buffer, dirmap->hdr, dirmap->len);
+	for (i = tmpl->addr.nbytes - 1; i >= 0; i--) {
+		fx2_op_buffer[dirmap->addr_pos + i] = addr & 0xff;
+		addr >>= 8;
+	}
+
+	ret = fx2qspi_xfer(spi_mem_get_drvdata(desc->mem), dirmap->len,
+			   tmpl->data.buswidth, tmpl->data.dir, data, len);
+	return ret ? ret : len;
+}
+
+static ssize_t fx2qspi_dirmap_read(struct spi_mem_dirmap_desc *desc,
+				   u64 offs, size_t len, void *buf)
+{
+	return fx2qspi_dirmap_xfer(desc, offs, len, buf);
+}
+
+static ssize_t fx2qspi_dirmap_write(struct spi_mem_dirmap_desc *desc,
+				    u64 offs, size_t len, const void *buf)
+{
+	return fx2qspi_dirmap_xfer(desc, offs, len, (void *)buf);
+}
+
+static void *fx2qspi_alloc_buf(struct spi_mem *mem, size_t len)
+{
+	fx2qspi_priv *priv = spi_mem_get_drvdata(mem);
+
+	return usb_mem_alloc(&priv->pool, len);
+}
+
+static void fx2qspi_free_buf(struct spi_mem *mem, void *buf)
+{
+	fx2qspi_priv *priv = spi_mem_get_drvdata(mem);
+
+	usb_mem_free(&priv->pool, buf);
+}
+
 static const struct spi_controller_mem_ops _fx2qspi_mem_ops = {
 	.adjust_op_size = fx2qspi_adjust_op_size,
 	.exec_op = fx2qspi_exec_op,
+	.dirmap_create = fx2qspi_dirmap_create,
+	.dirmap_destroy = fx2qspi_dirmap_destroy,
+	.dirmap_read = fx2qspi_dirmap_read,
+	.dirmap_write = fx2qspi_dirmap_write,
+	.alloc_buf = fx2qspi_alloc_buf,
+	.free_buf = fx2qspi_free_buf,
 };
 
 static struct spi_mem _fx2qspi_mem = {
@@ -131,7 +282,7 @@ static struct spi_mem _fx2qspi_mem = {
 static int fx2qspi_reset(fx2qspi_priv *priv)
 {
 	int i, actual_len, ret;
-	memset(fx2_op_buffer, 0, sizeof(fx2_op_buffer));
+	memset(fx2_op_buffer, 0, FX2_BUF_SIZE);
 	// write 4096 bytes of 0
 	for (i = 0; i < 4; i++) {
 		ret = libusb_bulk_transfer(priv->handle, FX2_EPOUT,
@@ -179,11 +330,17 @@ struct spi_mem *fx2qspi_probe()
 		goto ERR_2;
 	}
 
+	usb_mem_pool_init(&priv->pool, priv->handle);
+	fx2_op_buffer = usb_mem_alloc(&priv->pool, FX2_BUF_SIZE);
+	if (!fx2_op_buffer)
+		goto ERR_3;
+
 	if (fx2qspi_reset(priv))
 		goto ERR_3;
 
 	return &_fx2qspi_mem;
 ERR_3:
+	usb_mem_pool_destroy(&priv->pool);
 	libusb_release_interface(priv->handle, 0);
 ERR_2:
 	libusb_close(priv->handle);
@@ -195,6 +352,7 @@ ERR_1:
 void fx2qspi_remove(struct spi_mem *mem)
 {
 	fx2qspi_priv *priv = spi_mem_get_drvdata(mem);
+	usb_mem_pool_destroy(&priv->pool);
 	libusb_release_interface(priv->handle, 0);
 	libusb_close(priv->handle);
 	libusb_exit(priv->ctx);
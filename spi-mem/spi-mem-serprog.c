@@ -9,8 +9,13 @@
 #include <errno.h>
 #include <string.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 
 static int serial_fd;
+static u8 serprog_cmdmap[32];
+/* Programmer receive buffer size, 16 bytes unless told otherwise. */
+static u16 serprog_serbuf = 16;
 u8 zero_buf[4];
 
 static int serial_config(int fd, int speed)
@@ -76,24 +81,168 @@ ERR:
 	return ret;
 }
 
+/*
+ * Requests are staged and written out with a single writev() once an answer
+ * is awaited, so that small commands and pipelined sequences take as few
+ * USB packets as possible. Headers and short data are copied in
+ * serprog_txbuf, longer data is sent from the caller's buffer, which must
+ * stay valid until the answer is read.
+ */
+#define SERPROG_TXBUF_SIZE	4096
+#define SERPROG_TX_COPY_MAX	64
+#define SERPROG_TX_IOV_MAX	64
+
+static u8 serprog_txbuf[SERPROG_TXBUF_SIZE];
+static size_t serprog_txlen;
+static struct iovec serprog_tx_iov[SERPROG_TX_IOV_MAX];
+static int serprog_tx_niov;
+
+/* Answers are read in large chunks and handed out from serprog_rxbuf. */
+#define SERPROG_RXBUF_SIZE	4096
+
+static u8 serprog_rxbuf[SERPROG_RXBUF_SIZE];
+static size_t serprog_rxhead, serprog_rxtail;
+
+static int serprog_flush(void)
+{
+	struct iovec *cur = serprog_tx_iov;
+	int niov = serprog_tx_niov;
+	ssize_t rwsize;
+
+	serprog_tx_niov = 0;
+	serprog_txlen = 0;
+
+	while (niov) {
+		rwsize = writev(serial_fd, cur, niov);
+		if (rwsize < 0) {
+			perror("serprog: write");
+			return errno;
+		}
+		while (niov && (size_t)rwsize >= cur->iov_len) {
+			rwsize -= cur->iov_len;
+			cur++;
+			niov--;
+		}
+		if (niov) {
+			cur->iov_base += rwsize;
+			cur->iov_len -= rwsize;
+		}
+	}
+	return 0;
+}
+
+static int serprog_queue(const void *buf, size_t len, bool copy)
+{
+	struct iovec *last = NULL;
+	u8 *dst;
+	int ret;
+
+	if (!len)
+		return 0;
+
+	if (len > SERPROG_TXBUF_SIZE)
+		copy = false;
+
+	if (serprog_tx_niov == SERPROG_TX_IOV_MAX ||
+	    (copy && serprog_txlen + len > SERPROG_TXBUF_SIZE)) {
+		ret = serprog_flush();
+		if (ret)
+			return ret;
+	}
+
+	if (serprog_tx_niov)
+		last = &serprog_tx_iov[serprog_tx_niov - 1];
+
+	if (copy) {
+		dst = serprog_txbuf + serprog_txlen;
+		memcpy(dst, buf, len);
+		serprog_txlen += len;
+		if (last && last->iov_base + last->iov_len == dst) {
+			last->iov_len += len;
+			return 0;
+		}
+		buf = dst;
+	}
+
+	serprog_tx_iov[serprog_tx_niov].iov_base = (void *)buf;
+	serprog_tx_iov[serprog_tx_niov].iov_len = len;
+	serprog_tx_niov++;
+	return 0;
+}
+
+static size_t serprog_rx_buffered(void)
+{
+	return serprog_rxtail - serprog_rxhead;
+}
+
+/*
+ * Read @len answer bytes, sending the staged requests first. Reads that
+ * the buffer cannot hold go straight to @buf once it is drained.
+ */
+static int serprog_read(void *buf, size_t len)
+{
+	ssize_t rwsize;
+	size_t n;
+	int ret;
+
+	ret = serprog_flush();
+	if (ret)
+		return ret;
+
+	while (len) {
+		if (!serprog_rx_buffered() && len >= SERPROG_RXBUF_SIZE) {
+			rwsize = read(serial_fd, buf, len);
+			if (rwsize <= 0) {
+				perror("serprog: read");
+				return rwsize ? errno : -EIO;
+			}
+			buf += rwsize;
+			len -= rwsize;
+			continue;
+		}
+
+		if (!serprog_rx_buffered()) {
+			rwsize = read(serial_fd, serprog_rxbuf,
+				      SERPROG_RXBUF_SIZE);
+			if (rwsize <= 0) {
+				perror("serprog: read");
+				return rwsize ? errno : -EIO;
+			}
+			serprog_rxhead = 0;
+			serprog_rxtail = rwsize;
+		}
+
+		n = serprog_rx_buffered();
+		if (n > len)
+			n = len;
+		memcpy(buf, serprog_rxbuf + serprog_rxhead, n);
+		serprog_rxhead += n;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
 static int serprog_sync()
 {
-	char c;
+	u8 c;
 	int ret;
 	c = S_CMD_SYNCNOP;
-	write(serial_fd, &c, 1);
-	ret = read(serial_fd, &c, 1);
-	if (ret != 1) {
-		perror("serprog: sync r1");
+	ret = serprog_queue(&c, 1, true);
+	if (ret)
+		return -EINVAL;
+	ret = serprog_read(&c, 1);
+	if (ret) {
+		fprintf(stderr, "serprog: sync r1 failed.\n");
 		return -EINVAL;
 	}
 	if (c != S_NAK) {
 		fprintf(stderr, "serprog: sync NAK failed.\n");
 		return -EINVAL;
 	}
-	ret = read(serial_fd, &c, 1);
-	if (ret != 1) {
-		perror("serprog: sync r2");
+	ret = serprog_read(&c, 1);
+	if (ret) {
+		fprintf(stderr, "serprog: sync r2 failed.\n");
 		return -EINVAL;
 	}
 	if (c != S_ACK) {
@@ -106,10 +255,11 @@ static int serprog_sync()
 static int serprog_check_ack()
 {
 	unsigned char c;
-	if (read(serial_fd, &c, 1) <= 0) {
-		perror("serprog: exec_op: read status");
-		return errno;
-	}
+	int ret;
+
+	ret = serprog_read(&c, 1);
+	if (ret)
+		return ret;
 	if (c == S_NAK) {
 		fprintf(stderr, "serprog: exec_op: NAK\n");
 		return -EINVAL;
@@ -126,47 +276,58 @@ static int serprog_check_ack()
 static int serprog_exec_op(u8 command, u32 parmlen, u8 *params,
 		    u32 retlen, void *retparms)
 {
-	if (write(serial_fd, &command, 1) < 0) {
-		perror("serprog: exec_op: write cmd");
-		return errno;
-	}
-	if (write(serial_fd, params, parmlen) < 0) {
-		perror("serprog: exec_op: write param");
-		return errno;
-	}
+	int ret;
+
+	ret = serprog_queue(&command, 1, true);
+	if (!ret)
+		ret = serprog_queue(params, parmlen, true);
+	if (ret)
+		return ret;
 	if (serprog_check_ack() < 0)
 		return -EINVAL;
 	if (retlen) {
-		if (read(serial_fd, retparms, retlen) != retlen) {
-			perror("serprog: exec_op: read return buffer");
+		if (serprog_read(retparms, retlen)) {
+			fprintf(stderr, "serprog: exec_op: read return buffer failed.\n");
 			return 1;
 		}
 	}
 	return 0;
 }
 
-static int serprog_get_cmdmap(u32 *cmdmap)
+static int serprog_get_cmdmap(void)
+{
+	if (serprog_exec_op(S_CMD_Q_CMDMAP, 0, NULL, sizeof(serprog_cmdmap),
+			    serprog_cmdmap) < 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+static bool serprog_has_cmd(u8 cmd)
+{
+	return serprog_cmdmap[cmd / 8] & (1 << (cmd % 8));
+}
+
+static int serprog_get_serbuf(void)
 {
-	u8 buf[32];
+	u8 buf[2];
+
+	if (!serprog_has_cmd(S_CMD_Q_SERBUF))
+		return 0;
 
-	if (serprog_exec_op(S_CMD_Q_CMDMAP, 0, NULL, 32, buf) < 0)
+	if (serprog_exec_op(S_CMD_Q_SERBUF, 0, NULL, sizeof(buf), buf))
 		return -EINVAL;
 
-	*cmdmap = buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+	if (buf[0] | buf[1] << 8)
+		serprog_serbuf = buf[0] | buf[1] << 8;
 	return 0;
 }
 
 static int serprog_set_spi_speed(u32 speed)
 {
 	u8 buf[4];
-	u32 cmdmap = 0;
-	int ret;
 
-	ret = serprog_get_cmdmap(&cmdmap);
-	if (ret < 0)
-		return ret;
-
-	if (!(cmdmap & (1 << S_CMD_S_SPI_FREQ))) {
+	if (!serprog_has_cmd(S_CMD_S_SPI_FREQ)) {
 		printf("serprog: programmer do not support set SPI clock freq.\n");
 		return 0;
 	}
@@ -195,12 +356,17 @@ static int serprog_adjust_op_size(struct spi_mem *mem, struct spi_mem_op *op)
 	return 0;
 }
 
-static int serprog_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
+/* SPIOP command, lengths, opcode, up to 4 address bytes and dummy bytes. */
+#define SERPROG_OP_HDR_MAX	32
+
+/*
+ * Encode the SPIOP command for @op, up to the data to write. Returns the
+ * header length or a negative error code.
+ */
+static int serprog_encode_op(const struct spi_mem_op *op, u8 *buf)
 {
-	size_t i;
+	size_t i, p;
 	u32 wrlen, rdlen, tmp;
-	u8 buf[10];
-	ssize_t rwdone, rwpending, rwsize;
 
 	wrlen = 1 + op->addr.nbytes + op->dummy.nbytes;
 
@@ -221,6 +387,10 @@ static int serprog_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 		return -E2BIG;
 	}
 
+	if (op->addr.nbytes > 4 ||
+	    8 + op->addr.nbytes + op->dummy.nbytes > SERPROG_OP_HDR_MAX)
+		return -EINVAL;
+
 	buf[0] = S_CMD_O_SPIOP;
 	buf[1] = wrlen & 0xff;
 	buf[2] = (wrlen >> 8) & 0xff;
@@ -228,83 +398,558 @@ static int serprog_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 	buf[4] = rdlen & 0xff;
 	buf[5] = (rdlen >> 8) & 0xff;
 	buf[6] = (rdlen >> 16) & 0xff;
+	buf[7] = op->cmd.opcode;
+	p = 8;
 
-	if (write(serial_fd, buf, 7) != 7) {
-		perror("serprog: spimem_exec_op: write serprog cmd");
-		return errno;
+	tmp = op->addr.val;
+	for (i = op->addr.nbytes; i; i--) {
+		buf[p + i - 1] = tmp & 0xff;
+		tmp >>= 8;
 	}
+	p += op->addr.nbytes;
 
-	buf[0] = op->cmd.opcode;
-	if (write(serial_fd, buf, 1) != 1) {
-		perror("serprog: spimem_exec_op: write opcode");
-		return errno;
+	for (i = 0; i < op->dummy.nbytes; i++)
+		buf[p++] = 0;
+
+	return p;
+}
+
+/* Stage a command header and its data, see serprog_flush(). */
+static int serprog_queue_cmd(const u8 *hdr, size_t hlen,
+			     const struct spi_mem_data_seg *segs,
+			     unsigned int nsegs)
+{
+	unsigned int i;
+	int ret;
+
+	ret = serprog_queue(hdr, hlen, true);
+	for (i = 0; !ret && i < nsegs; i++)
+		ret = serprog_queue(segs[i].buf.out, segs[i].nbytes,
+				    segs[i].nbytes <= SERPROG_TX_COPY_MAX);
+	return ret;
+}
+
+static int serprog_send_op(const struct spi_mem_op *op)
+{
+	struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
+	u8 buf[SERPROG_OP_HDR_MAX];
+	unsigned int nsegs = 0;
+	int ret;
+
+	ret = serprog_encode_op(op, buf);
+	if (ret < 0)
+		return ret;
+
+	if (op->data.dir == SPI_MEM_DATA_OUT)
+		nsegs = spi_mem_op_data_segs(op, segs);
+
+	return serprog_queue_cmd(buf, ret, segs, nsegs);
+}
+
+static int serprog_recv_segs(const struct spi_mem_data_seg *segs,
+			     unsigned int nsegs)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nsegs; i++) {
+		ret = serprog_read(segs[i].buf.in, segs[i].nbytes);
+		if (ret)
+			return ret;
 	}
+	return 0;
+}
+
+static int serprog_recv_op(const struct spi_mem_op *op)
+{
+	struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
 
-	if (op->addr.nbytes > 4)
+	if (op->data.dir != SPI_MEM_DATA_IN)
+		return 0;
+
+	return serprog_recv_segs(segs, spi_mem_op_data_segs(op, segs));
+}
+
+/*
+ * Most answer bytes left unread by operations in flight. They wait in the
+ * host tty buffer, which must not overflow.
+ */
+#define SERPROG_MAX_PENDING_RX	4096
+
+/* Request bytes the programmer has not answered yet, and answers pending. */
+static size_t serprog_inflight_tx;
+static size_t serprog_pending_rx;
+
+static size_t serprog_op_tx_len(const struct spi_mem_op *op)
+{
+	size_t len = 8 + op->addr.nbytes + op->dummy.nbytes;
+
+	if (op->data.dir == SPI_MEM_DATA_OUT)
+		len += op->data.nbytes;
+	return len;
+}
+
+static size_t serprog_op_rx_len(const struct spi_mem_op *op)
+{
+	return 1 + (op->data.dir == SPI_MEM_DATA_IN ? op->data.nbytes : 0);
+}
+
+/*
+ * Requests are pipelined as long as the programmer can buffer all those it
+ * has not answered yet (S_CMD_Q_SERBUF), so that writing never blocks on it,
+ * and their answers fit in the host tty buffer. An operation is always sent
+ * when nothing is in flight, however large.
+ */
+static bool serprog_window_fits(const struct spi_mem_op *op)
+{
+	if (!serprog_inflight_tx)
+		return true;
+
+	return serprog_inflight_tx + serprog_op_tx_len(op) <= serprog_serbuf &&
+	       serprog_pending_rx + serprog_op_rx_len(op) <=
+		       SERPROG_MAX_PENDING_RX;
+}
+
+static int serprog_start_op(const struct spi_mem_op *op)
+{
+	int ret;
+
+	ret = serprog_send_op(op);
+	if (ret)
+		return ret;
+
+	serprog_inflight_tx += serprog_op_tx_len(op);
+	serprog_pending_rx += serprog_op_rx_len(op);
+	return 0;
+}
+
+/* Collect the answer of the oldest operation in flight, which is @op. */
+static int serprog_finish_op(const struct spi_mem_op *op)
+{
+	serprog_inflight_tx -= serprog_op_tx_len(op);
+	serprog_pending_rx -= serprog_op_rx_len(op);
+
+	if (serprog_check_ack() < 0)
 		return -EINVAL;
-	if (op->addr.nbytes) {
-		tmp = op->addr.val;
-		for (i = op->addr.nbytes; i; i--) {
-			buf[i - 1] = tmp & 0xff;
-			tmp >>= 8;
-		}
-		if (write(serial_fd, buf, op->addr.nbytes) != op->addr.nbytes) {
-			perror("serprog: spimem_exec_op: write addr");
-			return errno;
+
+	return serprog_recv_op(op);
+}
+
+static int serprog_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
+{
+	int ret;
+
+	ret = serprog_start_op(op);
+	if (ret)
+		return ret;
+
+	return serprog_finish_op(op);
+}
+
+/*
+ * Keep sending the sequence while the window allows and collect the answers
+ * in order as room is needed, so that the requests stream without waiting a
+ * round trip each. Nothing more is sent after a failure, but the answers
+ * of the operations already sent are still drained to stay in sync.
+ */
+static int serprog_mem_exec_ops(struct spi_mem *mem,
+				const struct spi_mem_op *ops, unsigned int nops)
+{
+	unsigned int sent = 0, done = 0;
+	int ret = 0, err;
+
+	while (done < nops) {
+		if (!ret && sent < nops && serprog_window_fits(&ops[sent])) {
+			ret = serprog_start_op(&ops[sent]);
+			if (!ret)
+				sent++;
+			continue;
 		}
+
+		if (done == sent)
+			break;
+
+		err = serprog_finish_op(&ops[done++]);
+		if (err && !ret)
+			ret = err;
 	}
 
-	if (op->dummy.nbytes) {
-		buf[0] = 0;
-		for (i = 0; i < op->dummy.nbytes; i++) {
-			if (write(serial_fd, buf, 1) != 1) {
-				perror("serprog: spimem_exec_op: write dummy");
-				return errno;
-			}
-		}
+	return ret;
+}
+
+/*
+ * Encode the parameters shared by S_CMD_X_POLL_STATUS and S_CMD_X_EXEC_POLL,
+ * starting with the length of the status read command. Returns their length
+ * or a negative error code.
+ */
+static int serprog_encode_poll(const struct spi_mem_op *op, u16 mask,
+			       u16 match, unsigned long timeout_ms, u8 *buf)
+{
+	size_t i, p;
+	u32 tmp;
+
+	if (op->data.nbytes != 1 || op->addr.nbytes > 4 ||
+	    op->dummy.nbytes > 4)
+		return -EOPNOTSUPP;
+
+	if (timeout_ms > 0xffff)
+		timeout_ms = 0xffff;
+
+	p = 1;
+	buf[p++] = op->cmd.opcode;
+	tmp = op->addr.val;
+	for (i = op->addr.nbytes; i; i--) {
+		buf[p + i - 1] = tmp & 0xff;
+		tmp >>= 8;
 	}
+	p += op->addr.nbytes;
+	for (i = 0; i < op->dummy.nbytes; i++)
+		buf[p++] = 0;
+	buf[0] = p - 1;
+	buf[p++] = mask;
+	buf[p++] = match;
+	buf[p++] = timeout_ms & 0xff;
+	buf[p++] = (timeout_ms >> 8) & 0xff;
+
+	return p;
+}
 
-	if (op->data.dir == SPI_MEM_DATA_OUT && op->data.nbytes) {
-		rwpending = op->data.nbytes;
-		rwdone = 0;
-		while (rwpending) {
-			rwsize = write(serial_fd, op->data.buf.out + rwdone, rwpending);
-			if (rwsize < 0) {
-				perror("serprog: spimem_exec_op: write data");
-				return errno;
-			}
-			rwpending -= rwsize;
-			rwdone += rwsize;
-		}
+/*
+ * The programmer polls on its side and only answers once the status matched
+ * or the timeout expired. It polls as fast as it can, polling_rate_us is
+ * ignored.
+ */
+static int serprog_mem_poll_status(struct spi_mem *mem,
+				   const struct spi_mem_op *op, u16 mask,
+				   u16 match, unsigned long initial_delay_us,
+				   unsigned long polling_rate_us,
+				   unsigned long timeout_ms)
+{
+	u8 buf[16], res[2];
+	int ret;
+
+	ret = serprog_encode_poll(op, mask, match, timeout_ms, buf);
+	if (ret < 0)
+		return ret;
+
+	if (initial_delay_us)
+		usleep(initial_delay_us);
+
+	if (serprog_exec_op(S_CMD_X_POLL_STATUS, ret, buf, 2, res))
+		return -EIO;
+
+	*(u8 *)op->data.buf.in = res[1];
+	return res[0] ? 0 : -ETIMEDOUT;
+}
+
+static int serprog_check_ops(const struct spi_mem_op *ops, unsigned int nops)
+{
+	u8 buf[SERPROG_OP_HDR_MAX];
+	unsigned int i;
+	int ret;
+
+	if (nops > 0xff)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < nops; i++) {
+		ret = serprog_encode_op(&ops[i], buf);
+		if (ret < 0)
+			return ret;
 	}
+	return 0;
+}
+
+/*
+ * Stage a list of operations for S_CMD_X_EXEC_POLL, count first. They must
+ * have gone through serprog_check_ops().
+ */
+static int serprog_queue_ops(const struct spi_mem_op *ops, unsigned int nops)
+{
+	struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
+	u8 buf[SERPROG_OP_HDR_MAX];
+	unsigned int i, nsegs;
+	int ret;
+
+	buf[0] = nops;
+	ret = serprog_queue(buf, 1, true);
+
+	for (i = 0; !ret && i < nops; i++) {
+		ret = serprog_encode_op(&ops[i], buf);
+
+		nsegs = 0;
+		if (ops[i].data.dir == SPI_MEM_DATA_OUT)
+			nsegs = spi_mem_op_data_segs(&ops[i], segs);
+
+		/* Each op is encoded like the SPIOP parameters. */
+		ret = serprog_queue_cmd(buf + 1, ret - 1, segs, nsegs);
+	}
+
+	return ret;
+}
+
+static int serprog_recv_ops(const struct spi_mem_op *ops, unsigned int nops)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nops; i++) {
+		ret = serprog_recv_op(&ops[i]);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * The whole sequence is a single request, and the programmer waits for the
+ * memory on its side. The data of the post operations is read even if they
+ * were skipped, to stay in sync.
+ */
+static int serprog_mem_exec_ops_poll(struct spi_mem *mem,
+				     const struct spi_mem_op *pre,
+				     unsigned int npre,
+				     const struct spi_mem_op *op, u16 mask,
+				     u16 match, unsigned long timeout_ms,
+				     const struct spi_mem_op *post,
+				     unsigned int npost)
+{
+	u8 cmd = S_CMD_X_EXEC_POLL;
+	u8 buf[16], res[2];
+	int ret, plen;
+
+	ret = serprog_check_ops(pre, npre);
+	if (!ret)
+		ret = serprog_check_ops(post, npost);
+	if (ret)
+		return ret;
+
+	plen = serprog_encode_poll(op, mask, match, timeout_ms, buf);
+	if (plen < 0)
+		return plen;
+
+	ret = serprog_queue(&cmd, 1, true);
+	if (!ret)
+		ret = serprog_queue_ops(pre, npre);
+	if (!ret)
+		ret = serprog_queue(buf, plen, true);
+	if (!ret)
+		ret = serprog_queue_ops(post, npost);
+	if (ret)
+		return ret;
 
 	if (serprog_check_ack() < 0)
 		return -EINVAL;
-	if (op->data.dir == SPI_MEM_DATA_IN && op->data.nbytes) {
-		rwpending = op->data.nbytes;
-		rwdone = 0;
-		while (rwpending) {
-			rwsize = read(serial_fd, op->data.buf.in + rwdone, rwpending);
-			if (rwsize < 0) {
-				perror("serprog: spimem_exec_op: read data");
-				return errno;
-			}
-			rwpending -= rwsize;
-			rwdone += rwsize;
-		}
+
+	ret = serprog_read(res, sizeof(res));
+	if (!ret)
+		ret = serprog_recv_ops(pre, npre);
+	if (!ret)
+		ret = serprog_recv_ops(post, npost);
+	if (ret)
+		return ret;
+
+	*(u8 *)op->data.buf.in = res[1];
+	return res[0] ? 0 : -ETIMEDOUT;
+}
+
+/*
+ * The programmer loads, polls and reads each page on its side, only the
+ * status and CRC of each page come back.
+ */
+static int serprog_mem_read_crc32(struct spi_mem *mem,
+				  const struct spi_mem_op *load,
+				  unsigned int count,
+				  const struct spi_mem_op *op, u16 mask,
+				  u16 match, unsigned long timeout_ms,
+				  const struct spi_mem_op *read, u32 *crcs,
+				  u8 *status)
+{
+	u8 buf[SERPROG_OP_HDR_MAX], pbuf[16], res[5];
+	unsigned int i;
+	int ret, plen;
+
+	if (count > 0xffff || load->dummy.nbytes)
+		return -EOPNOTSUPP;
+
+	ret = serprog_check_ops(load, 1);
+	if (!ret)
+		ret = serprog_check_ops(read, 1);
+	if (ret)
+		return ret;
+
+	plen = serprog_encode_poll(op, mask, match, timeout_ms, pbuf);
+	if (plen < 0)
+		return plen;
+
+	buf[0] = S_CMD_X_PAGE_CRC32;
+	buf[1] = count & 0xff;
+	buf[2] = (count >> 8) & 0xff;
+	ret = serprog_queue(buf, 3, true);
+	if (ret)
+		return ret;
+
+	/* Both ops are encoded like the SPIOP parameters. */
+	ret = serprog_encode_op(load, buf);
+	ret = serprog_queue(buf + 1, ret - 1, true);
+	if (!ret)
+		ret = serprog_queue(pbuf, plen, true);
+	if (ret)
+		return ret;
+
+	ret = serprog_encode_op(read, buf);
+	ret = serprog_queue(buf + 1, ret - 1, true);
+	if (ret)
+		return ret;
+
+	if (serprog_check_ack() < 0)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		ret = serprog_read(res, sizeof(res));
+		if (ret)
+			return ret;
+
+		status[i] = res[0];
+		crcs[i] = res[1] | res[2] << 8 | res[3] << 16 |
+			  (u32)res[4] << 24;
 	}
+
 	return 0;
 }
 
-static const struct spi_controller_mem_ops _serprog_mem_ops = {
+static int serprog_mem_submit_op(struct spi_mem *mem,
+				 const struct spi_mem_op *op)
+{
+	if (!serprog_window_fits(op))
+		return -EBUSY;
+
+	return serprog_start_op(op);
+}
+
+static int serprog_mem_complete_op(struct spi_mem *mem,
+				   const struct spi_mem_op *op, bool wait)
+{
+	int avail;
+
+	if (!wait) {
+		if (serprog_flush())
+			return -EIO;
+		if (ioctl(serial_fd, FIONREAD, &avail) < 0 ||
+		    serprog_rx_buffered() + avail < serprog_op_rx_len(op))
+			return -EAGAIN;
+	}
+
+	return serprog_finish_op(op);
+}
+
+/* SPIOP header of a read dirmap, encoded once at creation time. */
+struct serprog_dirmap {
+	u8 hdr[SERPROG_OP_HDR_MAX];
+	int len;
+};
+
+/*
+ * Only reads are mapped: writes go through spi_mem_exec_op(), which lets the
+ * SPI-NAND layer queue them along with the PROGRAM EXECUTE in a single
+ * pipelined sequence.
+ */
+static int serprog_dirmap_create(struct spi_mem_dirmap_desc *desc)
+{
+	struct serprog_dirmap *dirmap;
+	int ret;
+
+	if (desc->info.op_tmpl.data.dir != SPI_MEM_DATA_IN)
+		return -EOPNOTSUPP;
+
+	dirmap = malloc(sizeof(*dirmap));
+	if (!dirmap)
+		return -ENOMEM;
+
+	ret = serprog_encode_op(&desc->info.op_tmpl, dirmap->hdr);
+	if (ret < 0) {
+		free(dirmap);
+		return ret;
+	}
+
+	dirmap->len = ret;
+	desc->priv = dirmap;
+	return 0;
+}
+
+static void serprog_dirmap_destroy(struct spi_mem_dirmap_desc *desc)
+{
+	free(desc->priv);
+}
+
+/* The whole mapped window is read with a single SPIOP. */
+static ssize_t serprog_dirmap_readv(struct spi_mem_dirmap_desc *desc,
+				    u64 offs,
+				    const struct spi_mem_data_seg *segs,
+				    unsigned int nsegs)
+{
+	struct spi_mem_data_seg rsegs[SPI_MEM_MAX_DATA_SEGS];
+	struct serprog_dirmap *dirmap = desc->priv;
+	u32 addr = desc->info.offset + offs;
+	size_t i, naddr = desc->info.op_tmpl.addr.nbytes;
+	size_t len = 0;
+	int ret;
+
+	if (offs >= desc->info.length)
+		return -EINVAL;
+
+	for (i = 0; i < nsegs; i++)
+		len += segs[i].nbytes;
+	if (len > desc->info.length - offs)
+		len = desc->info.length - offs;
+	nsegs = spi_mem_data_segs_trim(segs, nsegs, len, rsegs);
+
+	dirmap->hdr[4] = len & 0xff;
+	dirmap->hdr[5] = (len >> 8) & 0xff;
+	dirmap->hdr[6] = (len >> 16) & 0xff;
+	for (i = naddr; i; i--) {
+		dirmap->hdr[8 + i - 1] = addr & 0xff;
+		addr >>= 8;
+	}
+
+	ret = serprog_queue_cmd(dirmap->hdr, dirmap->len, NULL, 0);
+	if (ret)
+		return ret;
+
+	if (serprog_check_ack() < 0)
+		return -EINVAL;
+
+	ret = serprog_recv_segs(rsegs, nsegs);
+	return ret ? ret : len;
+}
+
+static ssize_t serprog_dirmap_read(struct spi_mem_dirmap_desc *desc,
+				   u64 offs, size_t len, void *buf)
+{
+	struct spi_mem_data_seg seg = {
+		.buf.in = buf,
+		.nbytes = len,
+	};
+
+	return serprog_dirmap_readv(desc, offs, &seg, 1);
+}
+
+static struct spi_controller_mem_ops _serprog_mem_ops = {
 	.adjust_op_size = serprog_adjust_op_size,
 	.exec_op = serprog_mem_exec_op,
+	.exec_ops = serprog_mem_exec_ops,
+	.submit_op = serprog_mem_submit_op,
+	.complete_op = serprog_mem_complete_op,
+	.dirmap_create = serprog_dirmap_create,
+	.dirmap_destroy = serprog_dirmap_destroy,
+	.dirmap_read = serprog_dirmap_read,
+	.dirmap_readv = serprog_dirmap_readv,
 };
 
 static struct spi_mem _serprog_mem = {
 	.ops = &_serprog_mem_ops,
 	.spi_mode = 0,
 	.name = "serprog",
+	.data_segs = true,
 	.drvpriv = NULL,
 };
 
@@ -315,11 +960,23 @@ static int serprog_init(const char *devpath, u32 speed)
 	if (ret < 0)
 		return ret;
 	ret = serprog_sync();
+	if (ret < 0)
+		goto ERR;
+	ret = serprog_get_cmdmap();
+	if (ret < 0)
+		goto ERR;
+	ret = serprog_get_serbuf();
 	if (ret < 0)
 		goto ERR;
 	ret = serprog_set_spi_speed(speed);
 	if (ret < 0)
 		goto ERR;
+	if (serprog_has_cmd(S_CMD_X_POLL_STATUS))
+		_serprog_mem_ops.poll_status = serprog_mem_poll_status;
+	if (serprog_has_cmd(S_CMD_X_EXEC_POLL))
+		_serprog_mem_ops.exec_ops_poll = serprog_mem_exec_ops_poll;
+	if (serprog_has_cmd(S_CMD_X_PAGE_CRC32))
+		_serprog_mem_ops.read_crc32 = serprog_mem_read_crc32;
 	return 0;
 ERR:
 	close(serial_fd);
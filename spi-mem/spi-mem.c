@@ -10,7 +10,9 @@
  */
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <spi.h>
 #include <spi-mem.h>
 
@@ -99,6 +101,14 @@ static int spi_mem_check_op(const struct spi_mem_op *op)
 	    !spi_mem_buswidth_is_valid(op->data.buswidth))
 		return -EINVAL;
 
+	if (op->data.nsegs > SPI_MEM_MAX_DATA_SEGS)
+		return -EINVAL;
+
+	if (op->data.nsegs && op->data.nbytes &&
+	    !spi_mem_data_segs_trim(op->data.segs, op->data.nsegs,
+				    op->data.nbytes, NULL))
+		return -EINVAL;
+
 	return 0;
 }
 
@@ -134,6 +144,209 @@ bool spi_mem_supports_op(struct spi_mem *mem, const struct spi_mem_op *op)
 	return spi_mem_internal_supports_op(mem, op);
 }
 
+/**
+ * spi_mem_data_segs_trim() - Get the segments holding the first bytes of a
+ *			      scattered buffer
+ * @segs: the segments
+ * @nsegs: number of segments
+ * @nbytes: number of bytes wanted
+ * @out: where to copy the segments holding @nbytes, the last one being
+ *	 shortened to end there. May be NULL
+ *
+ * Return: the number of segments holding @nbytes, 0 if they are too short or
+ *	   if @nbytes is 0.
+ */
+unsigned int spi_mem_data_segs_trim(const struct spi_mem_data_seg *segs,
+				    unsigned int nsegs, size_t nbytes,
+				    struct spi_mem_data_seg *out)
+{
+	unsigned int i;
+
+	for (i = 0; i < nsegs && nbytes; i++) {
+		if (out) {
+			out[i] = segs[i];
+			if (out[i].nbytes > nbytes)
+				out[i].nbytes = nbytes;
+		}
+		nbytes -= segs[i].nbytes < nbytes ? segs[i].nbytes : nbytes;
+	}
+
+	return nbytes ? 0 : i;
+}
+
+/**
+ * spi_mem_op_data_segs() - Get the data of an operation as segments
+ * @op: the memory operation
+ * @out: where to store the segments, at least SPI_MEM_MAX_DATA_SEGS entries
+ *
+ * Gives controller drivers a single view of the data, whether it is in
+ * @op->data.buf or scattered over @op->data.segs.
+ *
+ * Return: the number of segments holding @op->data.nbytes.
+ */
+unsigned int spi_mem_op_data_segs(const struct spi_mem_op *op,
+				  struct spi_mem_data_seg *out)
+{
+	if (op->data.dir == SPI_MEM_NO_DATA || !op->data.nbytes)
+		return 0;
+
+	if (op->data.nsegs)
+		return spi_mem_data_segs_trim(op->data.segs, op->data.nsegs,
+					      op->data.nbytes, out);
+
+	out[0].buf.in = op->data.buf.in;
+	out[0].nbytes = op->data.nbytes;
+	return 1;
+}
+
+/**
+ * spi_mem_op_data_gather() - Copy the data to send into a linear buffer
+ * @op: the memory operation
+ * @buf: destination buffer, @op->data.nbytes long
+ */
+void spi_mem_op_data_gather(const struct spi_mem_op *op, void *buf)
+{
+	struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
+	unsigned int i, nsegs;
+
+	nsegs = spi_mem_op_data_segs(op, segs);
+	for (i = 0; i < nsegs; i++) {
+		memcpy(buf, segs[i].buf.out, segs[i].nbytes);
+		buf += segs[i].nbytes;
+	}
+}
+
+/**
+ * spi_mem_op_data_scatter() - Copy received data from a linear buffer
+ * @op: the memory operation
+ * @buf: source buffer, @op->data.nbytes long
+ */
+void spi_mem_op_data_scatter(const struct spi_mem_op *op, const void *buf)
+{
+	struct spi_mem_data_seg segs[SPI_MEM_MAX_DATA_SEGS];
+	unsigned int i, nsegs;
+
+	nsegs = spi_mem_op_data_segs(op, segs);
+	for (i = 0; i < nsegs; i++) {
+		memcpy(segs[i].buf.in, buf, segs[i].nbytes);
+		buf += segs[i].nbytes;
+	}
+}
+
+/*
+ * Hand @op over to the controller, through a bounce buffer if its data is
+ * scattered and the controller can't deal with it.
+ */
+static int spi_mem_exec_one(struct spi_mem *mem, const struct spi_mem_op *op)
+{
+	struct spi_mem_op lop;
+	void *buf;
+	int ret;
+
+	if (!op->data.nsegs || mem->data_segs)
+		return mem->ops->exec_op(mem, op);
+
+	buf = malloc(op->data.nbytes);
+	if (!buf)
+		return -ENOMEM;
+
+	lop = *op;
+	lop.data.buf.in = buf;
+	lop.data.segs = NULL;
+	lop.data.nsegs = 0;
+	if (op->data.dir == SPI_MEM_DATA_OUT)
+		spi_mem_op_data_gather(op, buf);
+
+	ret = mem->ops->exec_op(mem, &lop);
+	if (!ret && op->data.dir == SPI_MEM_DATA_IN)
+		spi_mem_op_data_scatter(op, buf);
+
+	free(buf);
+	return ret;
+}
+
+#define SPI_MEM_DEFAULT_QUEUE_DEPTH	16
+
+static int spi_mem_queue_alloc(struct spi_mem *mem, unsigned int depth)
+{
+	struct spi_mem_async_req *reqs;
+
+	reqs = calloc(depth, sizeof(*reqs));
+	if (!reqs)
+		return -ENOMEM;
+
+	free(mem->queue.reqs);
+	mem->queue.reqs = reqs;
+	mem->queue.depth = depth;
+	mem->queue.head = 0;
+	mem->queue.count = 0;
+	return 0;
+}
+
+/* Complete the oldest operation in flight, waiting for it if @wait is set. */
+static int spi_mem_complete_one(struct spi_mem *mem, bool wait)
+{
+	struct spi_mem_queue *queue = &mem->queue;
+	struct spi_mem_async_req *req = &queue->reqs[queue->head];
+	int ret;
+
+	if (!req->done) {
+		ret = mem->ops->complete_op(mem, &req->op, wait);
+		if (ret == -EAGAIN && !wait)
+			return ret;
+
+		req->ret = ret;
+		req->done = true;
+	}
+
+	/* The callback may submit again, which can reuse this slot. */
+	ret = req->ret;
+	queue->head = (queue->head + 1) % queue->depth;
+	queue->count--;
+	if (req->complete)
+		req->complete(req->arg, ret);
+
+	return ret;
+}
+
+/*
+ * Synchronous accesses must not overtake the asynchronous ones still in
+ * flight. Their errors are reported through their completion callbacks.
+ */
+static void spi_mem_sync(struct spi_mem *mem)
+{
+	if (mem->queue.count)
+		spi_mem_drain(mem);
+}
+
+static void spi_mem_queued_complete(void *arg, int ret)
+{
+	*(int *)arg = ret;
+}
+
+/*
+ * Execute @op after the asynchronous operations in flight. Controllers
+ * implementing ->submit_op() get it queued behind them, so that it goes out
+ * along with them instead of after their answers.
+ */
+static int spi_mem_exec_queued(struct spi_mem *mem,
+			       const struct spi_mem_op *op)
+{
+	int ret, err;
+
+	if (!mem->queue.count || !mem->ops->submit_op) {
+		spi_mem_sync(mem);
+		return spi_mem_exec_one(mem, op);
+	}
+
+	ret = spi_mem_submit_op(mem, op, spi_mem_queued_complete, &err);
+	if (ret)
+		return ret;
+
+	spi_mem_drain(mem);
+	return err;
+}
+
 /**
  * spi_mem_exec_op() - Execute a memory operation
  * @mem: the SPI memory
@@ -157,7 +370,498 @@ int spi_mem_exec_op(struct spi_mem *mem, const struct spi_mem_op *op)
 	if (!spi_mem_internal_supports_op(mem, op))
 		return -EOPNOTSUPP;
 
-	return mem->ops->exec_op(mem, op);
+	return spi_mem_exec_queued(mem, op);
+}
+
+/*
+ * Check a sequence of operations, and tell in @bounce whether some of them
+ * have scattered data the controller can't take as is.
+ */
+static int spi_mem_check_ops(struct spi_mem *mem,
+			     const struct spi_mem_op *ops, unsigned int nops,
+			     bool *bounce)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nops; i++) {
+		ret = spi_mem_check_op(&ops[i]);
+		if (ret)
+			return ret;
+
+		if (!spi_mem_internal_supports_op(mem, &ops[i]))
+			return -EOPNOTSUPP;
+
+		if (ops[i].data.nsegs && !mem->data_segs)
+			*bounce = true;
+	}
+
+	return 0;
+}
+
+/**
+ * spi_mem_exec_ops() - Execute a sequence of memory operations
+ * @mem: the SPI memory
+ * @ops: the memory operations to execute, in order
+ * @nops: number of operations
+ *
+ * Executes several memory operations, each one in its own CS cycle. This is
+ * equivalent to calling spi_mem_exec_op() for each of them, but controllers
+ * implementing ->exec_ops() can send the whole sequence at once, which saves
+ * a round trip per operation on USB or serial attached programmers.
+ *
+ * Return: 0 in case of success, a negative error code otherwise. Operations
+ *	   following a failed one are not executed.
+ */
+int spi_mem_exec_ops(struct spi_mem *mem, const struct spi_mem_op *ops,
+		     unsigned int nops)
+{
+	bool bounce = false;
+	unsigned int i;
+	int ret;
+
+	ret = spi_mem_check_ops(mem, ops, nops, &bounce);
+	if (ret)
+		return ret;
+
+	if (nops > 1 && mem->ops->exec_ops && !bounce) {
+		spi_mem_sync(mem);
+		ret = mem->ops->exec_ops(mem, ops, nops);
+		if (ret != -EOPNOTSUPP)
+			return ret;
+	}
+
+	for (i = 0; i < nops; i++) {
+		ret = spi_mem_exec_queued(mem, &ops[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * spi_mem_set_queue_depth() - Set the number of asynchronous operations which
+ *			       may be in flight
+ * @mem: the SPI memory
+ * @depth: most operations in flight
+ *
+ * Operations in flight are completed first.
+ *
+ * Return: 0 in case of success, a negative error code otherwise.
+ */
+int spi_mem_set_queue_depth(struct spi_mem *mem, unsigned int depth)
+{
+	if (!depth)
+		return -EINVAL;
+
+	spi_mem_drain(mem);
+
+	return spi_mem_queue_alloc(mem, depth);
+}
+
+/**
+ * spi_mem_submit_op() - Submit a memory operation without waiting for it
+ * @mem: the SPI memory
+ * @op: the memory operation to execute. It is copied, but the data buffer or
+ *	segments it points to must stay valid until the operation completed
+ * @complete: called with the result of the operation once it completed, from
+ *	      spi_mem_submit_op(), spi_mem_poll() or spi_mem_drain(). May be
+ *	      NULL
+ * @arg: argument passed to @complete
+ *
+ * Operations are executed and completed in submission order, and before any
+ * operation executed synchronously afterwards. Controllers implementing
+ * ->submit_op() keep several of them in flight, others execute them right
+ * away and only defer the completion.
+ *
+ * When the queue is full, the oldest operation is completed first.
+ *
+ * Return: 0 if the operation was submitted, a negative error code otherwise.
+ *	   Errors of the operation itself are passed to @complete.
+ */
+int spi_mem_submit_op(struct spi_mem *mem, const struct spi_mem_op *op,
+		      void (*complete)(void *arg, int ret), void *arg)
+{
+	struct spi_mem_queue *queue = &mem->queue;
+	struct spi_mem_async_req *req;
+	bool done = false;
+	int ret;
+
+	ret = spi_mem_check_op(op);
+	if (ret)
+		return ret;
+
+	if (!spi_mem_internal_supports_op(mem, op))
+		return -EOPNOTSUPP;
+
+	if (!queue->depth) {
+		ret = spi_mem_queue_alloc(mem, SPI_MEM_DEFAULT_QUEUE_DEPTH);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * Completion callbacks run from here may submit again, refilling the
+	 * queue, so the slot is only picked once none can run anymore.
+	 */
+	ret = -EOPNOTSUPP;
+	for (;;) {
+		while (queue->count == queue->depth)
+			spi_mem_complete_one(mem, true);
+
+		if (!mem->ops->submit_op || (op->data.nsegs && !mem->data_segs))
+			break;
+
+		ret = mem->ops->submit_op(mem, op);
+		if (ret != -EBUSY || !queue->count)
+			break;
+
+		spi_mem_complete_one(mem, true);
+	}
+
+	if (ret == -EOPNOTSUPP || ret == -EBUSY) {
+		spi_mem_sync(mem);
+		ret = spi_mem_exec_one(mem, op);
+		done = true;
+	} else if (ret) {
+		return ret;
+	}
+
+	req = &queue->reqs[(queue->head + queue->count) % queue->depth];
+	req->op = *op;
+	req->complete = complete;
+	req->arg = arg;
+	req->ret = ret;
+	req->done = done;
+	queue->count++;
+	return 0;
+}
+
+/**
+ * spi_mem_poll() - Complete the asynchronous operations which are done
+ * @mem: the SPI memory
+ *
+ * Calls the completion callback of the operations which completed, in
+ * submission order, without waiting for the others.
+ *
+ * Return: the number of operations still in flight.
+ */
+unsigned int spi_mem_poll(struct spi_mem *mem)
+{
+	while (mem->queue.count && spi_mem_complete_one(mem, false) != -EAGAIN)
+		;
+
+	return mem->queue.count;
+}
+
+/**
+ * spi_mem_drain() - Wait for all the asynchronous operations to complete
+ * @mem: the SPI memory
+ *
+ * Return: 0 if all the operations succeeded, the error of the first failed
+ *	   one otherwise.
+ */
+int spi_mem_drain(struct spi_mem *mem)
+{
+	int ret, err = 0;
+
+	while (mem->queue.count) {
+		ret = spi_mem_complete_one(mem, true);
+		if (ret && !err)
+			err = ret;
+	}
+
+	return err;
+}
+
+/**
+ * spi_mem_can_poll_status() - Check whether the controller polls status
+ *			       registers on its side
+ * @mem: the SPI memory
+ *
+ * Return: true if spi_mem_poll_status() is offloaded to the controller, false
+ *	   if it falls back to polling with spi_mem_exec_op().
+ */
+bool spi_mem_can_poll_status(struct spi_mem *mem)
+{
+	return mem->ops->poll_status;
+}
+
+/**
+ * spi_mem_alloc_buf() - Allocate a data buffer suited to the controller
+ * @mem: the SPI memory
+ * @len: size of the buffer
+ *
+ * Buffers meant to be passed as data of operations or direct mapping
+ * accesses should be allocated with this function. Controllers may hand out
+ * memory they can transfer without bouncing it.
+ *
+ * Return: the buffer, or NULL on failure. It must be released with
+ *	   spi_mem_free_buf().
+ */
+void *spi_mem_alloc_buf(struct spi_mem *mem, size_t len)
+{
+	if (mem->ops->alloc_buf)
+		return mem->ops->alloc_buf(mem, len);
+
+	return malloc(len);
+}
+
+/**
+ * spi_mem_free_buf() - Release a buffer allocated by spi_mem_alloc_buf()
+ * @mem: the SPI memory
+ * @buf: the buffer, may be NULL
+ */
+void spi_mem_free_buf(struct spi_mem *mem, void *buf)
+{
+	if (mem->ops->free_buf)
+		mem->ops->free_buf(mem, buf);
+	else
+		free(buf);
+}
+
+static int spi_mem_read_status(struct spi_mem *mem,
+			       const struct spi_mem_op *op,
+			       u16 *status)
+{
+	const u8 *bytes = (u8 *)op->data.buf.in;
+	int ret;
+
+	ret = spi_mem_exec_op(mem, op);
+	if (ret)
+		return ret;
+
+	if (op->data.nbytes > 1)
+		*status = ((u16)bytes[0] << 8) | bytes[1];
+	else
+		*status = bytes[0];
+
+	return 0;
+}
+
+static u64 spi_mem_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void spi_mem_sleep_us(unsigned long us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = us % 1000000 * 1000,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+/**
+ * spi_mem_poll_status() - Poll memory device status
+ * @mem: SPI memory device
+ * @op: the memory operation to execute
+ * @mask: status bitmask to check
+ * @match: (status & mask) expected value
+ * @initial_delay_us: delay in us before starting to poll
+ * @polling_delay_us: time to sleep between reads in us
+ * @timeout_ms: timeout in milliseconds
+ *
+ * This function polls a status register and returns when
+ * (status & mask) == match or when the timeout has expired. The controller
+ * does the polling if it implements ->poll_status(), otherwise @op is
+ * executed repeatedly. In both cases the data buffer of @op holds the last
+ * status read.
+ *
+ * Return: 0 in case of success, -ETIMEDOUT in case of error,
+ *	   -EOPNOTSUPP if not supported.
+ */
+int spi_mem_poll_status(struct spi_mem *mem,
+			const struct spi_mem_op *op,
+			u16 mask, u16 match,
+			unsigned long initial_delay_us,
+			unsigned long polling_delay_us,
+			u16 timeout_ms)
+{
+	u64 deadline;
+	u16 status;
+	int ret = -EOPNOTSUPP;
+
+	if (op->data.nbytes < 1 || op->data.nbytes > 2 ||
+	    op->data.dir != SPI_MEM_DATA_IN)
+		return -EINVAL;
+
+	spi_mem_sync(mem);
+
+	if (mem->ops->poll_status)
+		ret = mem->ops->poll_status(mem, op, mask, match,
+					    initial_delay_us, polling_delay_us,
+					    timeout_ms);
+
+	if (ret != -EOPNOTSUPP)
+		return ret;
+
+	if (!spi_mem_supports_op(mem, op))
+		return ret;
+
+	if (initial_delay_us)
+		spi_mem_sleep_us(initial_delay_us);
+
+	deadline = spi_mem_time_us() + (u64)timeout_ms * 1000;
+	for (;;) {
+		ret = spi_mem_read_status(mem, op, &status);
+		if (ret)
+			return ret;
+
+		if ((status & mask) == match)
+			return 0;
+
+		if (spi_mem_time_us() >= deadline)
+			return -ETIMEDOUT;
+
+		if (polling_delay_us)
+			spi_mem_sleep_us(polling_delay_us);
+	}
+}
+
+/**
+ * spi_mem_can_exec_ops_poll() - Check whether the controller runs operations
+ *				 around a status poll on its side
+ * @mem: the SPI memory
+ *
+ * Return: true if spi_mem_exec_ops_poll() is offloaded to the controller,
+ *	   false if it falls back to spi_mem_exec_ops() and
+ *	   spi_mem_poll_status().
+ */
+bool spi_mem_can_exec_ops_poll(struct spi_mem *mem)
+{
+	return mem->ops->exec_ops_poll;
+}
+
+/**
+ * spi_mem_exec_ops_poll() - Execute memory operations around a status poll
+ * @mem: the SPI memory
+ * @pre: the memory operations to execute first
+ * @npre: number of operations in @pre
+ * @op: the status read operation, as for spi_mem_poll_status()
+ * @mask: status bitmask to check
+ * @match: (status & mask) expected value
+ * @timeout_ms: timeout in milliseconds
+ * @post: the memory operations to execute once the status matched
+ * @npost: number of operations in @post
+ *
+ * This is equivalent to spi_mem_exec_ops() on @pre, spi_mem_poll_status()
+ * and spi_mem_exec_ops() on @post, e.g. to start a page load and read the
+ * page out as soon as the memory is ready. Controllers implementing
+ * ->exec_ops_poll() do all of it with a single request. The data buffer of
+ * @op holds the last status read.
+ *
+ * Return: 0 in case of success, -ETIMEDOUT if the status didn't match in
+ *	   time, in which case @post is not executed, another negative error
+ *	   code otherwise.
+ */
+int spi_mem_exec_ops_poll(struct spi_mem *mem,
+			  const struct spi_mem_op *pre, unsigned int npre,
+			  const struct spi_mem_op *op, u16 mask, u16 match,
+			  u16 timeout_ms, const struct spi_mem_op *post,
+			  unsigned int npost)
+{
+	bool bounce = false;
+	int ret;
+
+	if (op->data.nbytes < 1 || op->data.nbytes > 2 ||
+	    op->data.dir != SPI_MEM_DATA_IN)
+		return -EINVAL;
+
+	ret = spi_mem_check_ops(mem, pre, npre, &bounce);
+	if (!ret)
+		ret = spi_mem_check_ops(mem, post, npost, &bounce);
+	if (ret)
+		return ret;
+
+	spi_mem_sync(mem);
+
+	if (mem->ops->exec_ops_poll && !bounce) {
+		ret = mem->ops->exec_ops_poll(mem, pre, npre, op, mask, match,
+					      timeout_ms, post, npost);
+		if (ret != -EOPNOTSUPP)
+			return ret;
+	}
+
+	ret = spi_mem_exec_ops(mem, pre, npre);
+	if (ret)
+		return ret;
+
+	ret = spi_mem_poll_status(mem, op, mask, match, 0, 0, timeout_ms);
+	if (ret)
+		return ret;
+
+	return spi_mem_exec_ops(mem, post, npost);
+}
+
+/**
+ * spi_mem_can_read_crc32() - Check whether the controller computes CRCs of
+ *			      the data it reads
+ * @mem: the SPI memory
+ *
+ * Return: true if spi_mem_read_crc32() is supported.
+ */
+bool spi_mem_can_read_crc32(struct spi_mem *mem)
+{
+	return mem->ops->read_crc32;
+}
+
+/**
+ * spi_mem_read_crc32() - Get the CRC32 of consecutive pages
+ * @mem: the SPI memory
+ * @load: the operation loading a page, its address being the first page
+ * @count: number of pages
+ * @op: the status read operation, as for spi_mem_poll_status(). Only one
+ *	byte status registers are supported
+ * @mask: status bitmask to check
+ * @match: (status & mask) expected value
+ * @timeout_ms: timeout in milliseconds, for each page
+ * @read: the operation reading a loaded page. Its data is not transferred,
+ *	  the buffer it points to is left untouched
+ * @crcs: where to store the CRC32 of each page, as computed by zlib
+ * @status: where to store the last status read for each page
+ *
+ * For each page, @load is executed with its address increased by the page
+ * index, the status polled until (status & mask) == match and @read
+ * executed. The controller does all of it on its side. Pages whose status
+ * didn't match in time are not read, their CRC is 0.
+ *
+ * Return: 0 in case of success, -EOPNOTSUPP if the controller doesn't
+ *	   implement ->read_crc32(), another negative error code otherwise.
+ */
+int spi_mem_read_crc32(struct spi_mem *mem, const struct spi_mem_op *load,
+		       unsigned int count, const struct spi_mem_op *op,
+		       u16 mask, u16 match, u16 timeout_ms,
+		       const struct spi_mem_op *read, u32 *crcs, u8 *status)
+{
+	bool bounce = false;
+	int ret;
+
+	if (!mem->ops->read_crc32)
+		return -EOPNOTSUPP;
+
+	if (op->data.nbytes != 1 || op->data.dir != SPI_MEM_DATA_IN ||
+	    load->data.nbytes || read->data.dir != SPI_MEM_DATA_IN)
+		return -EINVAL;
+
+	ret = spi_mem_check_ops(mem, load, 1, &bounce);
+	if (!ret)
+		ret = spi_mem_check_ops(mem, op, 1, &bounce);
+	if (!ret)
+		ret = spi_mem_check_ops(mem, read, 1, &bounce);
+	if (ret)
+		return ret;
+
+	spi_mem_sync(mem);
+
+	return mem->ops->read_crc32(mem, load, count, op, mask, match,
+				    timeout_ms, read, crcs, status);
 }
 
 /**
@@ -183,6 +887,18 @@ int spi_mem_adjust_op_size(struct spi_mem *mem, struct spi_mem_op *op)
 	return 0;
 }
 
+/*
+ * Execute an operation built from a dirmap template, which was checked by
+ * spi_mem_dirmap_create() already.
+ */
+static int spi_mem_exec_tmpl_op(struct spi_mem *mem,
+				const struct spi_mem_op *op)
+{
+	spi_mem_sync(mem);
+
+	return spi_mem_exec_one(mem, op);
+}
+
 static ssize_t spi_mem_no_dirmap_read(struct spi_mem_dirmap_desc *desc,
 				      u64 offs, size_t len, void *buf)
 {
@@ -196,7 +912,7 @@ static ssize_t spi_mem_no_dirmap_read(struct spi_mem_dirmap_desc *desc,
 	if (ret)
 		return ret;
 
-	ret = spi_mem_exec_op(desc->mem, &op);
+	ret = spi_mem_exec_tmpl_op(desc->mem, &op);
 	if (ret)
 		return ret;
 
@@ -216,7 +932,34 @@ static ssize_t spi_mem_no_dirmap_write(struct spi_mem_dirmap_desc *desc,
 	if (ret)
 		return ret;
 
-	ret = spi_mem_exec_op(desc->mem, &op);
+	ret = spi_mem_exec_tmpl_op(desc->mem, &op);
+	if (ret)
+		return ret;
+
+	return op.data.nbytes;
+}
+
+static ssize_t spi_mem_no_dirmap_xferv(struct spi_mem_dirmap_desc *desc,
+				       u64 offs,
+				       const struct spi_mem_data_seg *segs,
+				       unsigned int nsegs)
+{
+	struct spi_mem_op op = desc->info.op_tmpl;
+	unsigned int i;
+	int ret;
+
+	op.addr.val = desc->info.offset + offs;
+	op.data.segs = segs;
+	op.data.nsegs = nsegs;
+	op.data.nbytes = 0;
+	for (i = 0; i < nsegs; i++)
+		op.data.nbytes += segs[i].nbytes;
+
+	ret = spi_mem_adjust_op_size(desc->mem, &op);
+	if (ret)
+		return ret;
+
+	ret = spi_mem_exec_tmpl_op(desc->mem, &op);
 	if (ret)
 		return ret;
 
@@ -241,6 +984,7 @@ spi_mem_dirmap_create(struct spi_mem *mem,
 		      const struct spi_mem_dirmap_info *info)
 {
 	struct spi_mem_dirmap_desc *desc;
+	struct spi_mem_op tmpl;
 	int ret = -EOPNOTSUPP;
 
 	/* Make sure the number of address cycles is between 1 and 8 bytes. */
@@ -261,8 +1005,14 @@ spi_mem_dirmap_create(struct spi_mem *mem,
 		ret = mem->ops->dirmap_create(desc);
 
 	if (ret) {
+		/*
+		 * Check the template once here rather than for every access.
+		 * Give it some data so that the data phase is checked too.
+		 */
+		tmpl = desc->info.op_tmpl;
+		tmpl.data.nbytes = 1;
 		desc->nodirmap = true;
-		if (!spi_mem_supports_op(desc->mem, &desc->info.op_tmpl))
+		if (!spi_mem_supports_op(desc->mem, &tmpl))
 			ret = -EOPNOTSUPP;
 		else
 			ret = 0;
@@ -321,6 +1071,7 @@ ssize_t spi_mem_dirmap_read(struct spi_mem_dirmap_desc *desc,
 	if (desc->nodirmap) {
 		ret = spi_mem_no_dirmap_read(desc, offs, len, buf);
 	} else if (desc->mem->ops->dirmap_read) {
+		spi_mem_sync(desc->mem);
 		ret = desc->mem->ops->dirmap_read(desc, offs, len, buf);
 	} else {
 		ret = -EOPNOTSUPP;
@@ -359,6 +1110,7 @@ ssize_t spi_mem_dirmap_write(struct spi_mem_dirmap_desc *desc,
 	if (desc->nodirmap) {
 		ret = spi_mem_no_dirmap_write(desc, offs, len, buf);
 	} else if (desc->mem->ops->dirmap_write) {
+		spi_mem_sync(desc->mem);
 		ret = desc->mem->ops->dirmap_write(desc, offs, len, buf);
 	} else {
 		ret = -EOPNOTSUPP;
@@ -366,3 +1118,86 @@ ssize_t spi_mem_dirmap_write(struct spi_mem_dirmap_desc *desc,
 
 	return ret;
 }
+
+/**
+ * spi_mem_dirmap_readv() - Read scattered data through a direct mapping
+ * @desc: direct mapping descriptor
+ * @offs: offset to start reading from, within the direct mapping
+ * @segs: destination segments, filled in order. Their buffers must be
+ *	  DMA-able
+ * @nsegs: number of segments, at most SPI_MEM_MAX_DATA_SEGS
+ *
+ * Same as spi_mem_dirmap_read(), the data being scattered over several
+ * buffers, for instance the data and OOB parts of a page.
+ *
+ * Return: the amount of data read from the memory device or a negative error
+ * code. Note that the returned size might be smaller than the segments length,
+ * and the caller is responsible for calling spi_mem_dirmap_readv() again for
+ * the rest when that happens.
+ */
+ssize_t spi_mem_dirmap_readv(struct spi_mem_dirmap_desc *desc, u64 offs,
+			     const struct spi_mem_data_seg *segs,
+			     unsigned int nsegs)
+{
+	ssize_t ret;
+
+	if (desc->info.op_tmpl.data.dir != SPI_MEM_DATA_IN ||
+	    nsegs > SPI_MEM_MAX_DATA_SEGS)
+		return -EINVAL;
+
+	if (!nsegs)
+		return 0;
+
+	if (desc->nodirmap) {
+		ret = spi_mem_no_dirmap_xferv(desc, offs, segs, nsegs);
+	} else if (desc->mem->ops->dirmap_readv) {
+		spi_mem_sync(desc->mem);
+		ret = desc->mem->ops->dirmap_readv(desc, offs, segs, nsegs);
+	} else {
+		ret = spi_mem_dirmap_read(desc, offs, segs[0].nbytes,
+					  segs[0].buf.in);
+	}
+
+	return ret;
+}
+
+/**
+ * spi_mem_dirmap_writev() - Write gathered data through a direct mapping
+ * @desc: direct mapping descriptor
+ * @offs: offset to start writing from, within the direct mapping
+ * @segs: source segments, sent in order. Their buffers must be DMA-able
+ * @nsegs: number of segments, at most SPI_MEM_MAX_DATA_SEGS
+ *
+ * Same as spi_mem_dirmap_write(), the data being gathered from several
+ * buffers.
+ *
+ * Return: the amount of data written to the memory device or a negative error
+ * code. Note that the returned size might be smaller than the segments length,
+ * and the caller is responsible for calling spi_mem_dirmap_writev() again for
+ * the rest when that happens.
+ */
+ssize_t spi_mem_dirmap_writev(struct spi_mem_dirmap_desc *desc, u64 offs,
+			      const struct spi_mem_data_seg *segs,
+			      unsigned int nsegs)
+{
+	ssize_t ret;
+
+	if (desc->info.op_tmpl.data.dir != SPI_MEM_DATA_OUT ||
+	    nsegs > SPI_MEM_MAX_DATA_SEGS)
+		return -EINVAL;
+
+	if (!nsegs)
+		return 0;
+
+	if (desc->nodirmap) {
+		ret = spi_mem_no_dirmap_xferv(desc, offs, segs, nsegs);
+	} else if (desc->mem->ops->dirmap_writev) {
+		spi_mem_sync(desc->mem);
+		ret = desc->mem->ops->dirmap_writev(desc, offs, segs, nsegs);
+	} else {
+		ret = spi_mem_dirmap_write(desc, offs, segs[0].nbytes,
+					   segs[0].buf.out);
+	}
+
+	return ret;
+}
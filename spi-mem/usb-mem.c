@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <usb-mem.h>
+
+void usb_mem_pool_init(struct usb_mem_pool *pool,
+		       libusb_device_handle *handle)
+{
+	pool->handle = handle;
+	pool->bufs = NULL;
+}
+
+void usb_mem_pool_destroy(struct usb_mem_pool *pool)
+{
+	struct usb_mem_buf *b, *next;
+
+	for (b = pool->bufs; b; b = next) {
+		next = b->next;
+		if (b->in_use)
+			fprintf(stderr, "usb-mem: buffer %p still in use\n",
+				b->buf);
+		if (b->dev_mem)
+			libusb_dev_mem_free(pool->handle, b->buf, b->len);
+		else
+			free(b->buf);
+		free(b);
+	}
+	pool->bufs = NULL;
+}
+
+void *usb_mem_alloc(struct usb_mem_pool *pool, size_t len)
+{
+	struct usb_mem_buf *b, *best = NULL;
+
+	if (!len)
+		return NULL;
+
+	for (b = pool->bufs; b; b = b->next) {
+		if (b->in_use || b->len < len)
+			continue;
+		if (!best || b->len < best->len)
+			best = b;
+	}
+	if (best) {
+		best->in_use = true;
+		return best->buf;
+	}
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	b->len = len;
+	b->buf = libusb_dev_mem_alloc(pool->handle, len);
+	if (b->buf) {
+		b->dev_mem = true;
+	} else {
+		b->buf = malloc(len);
+		if (!b->buf) {
+			free(b);
+			return NULL;
+		}
+	}
+
+	b->in_use = true;
+	b->next = pool->bufs;
+	pool->bufs = b;
+	return b->buf;
+}
+
+void usb_mem_free(struct usb_mem_pool *pool, void *buf)
+{
+	struct usb_mem_buf *b;
+
+	if (!buf)
+		return;
+
+	for (b = pool->bufs; b; b = b->next) {
+		if (b->buf == buf) {
+			b->in_use = false;
+			return;
+		}
+	}
+	fprintf(stderr, "usb-mem: freeing unknown buffer %p\n", buf);
+}
@@ -16,12 +16,118 @@
 #include <string.h>
 #include <time.h>
 
+#define SPINAND_MAX_BATCH_OPS	8
+
+/*
+ * Most segments a cache access is split in: the data and OOB parts of the
+ * request, and the 0xff filled areas around them.
+ */
+#define SPINAND_MAX_CACHE_SEGS	5
+
+/*
+ * Operations collected while a batch is open, to be sent with a single
+ * spi_mem_exec_ops() call. Queued SET FEATUREs can't share the scratch
+ * buffer, their values are kept in @regs instead, and the data segments of
+ * queued cache loads in @segs.
+ */
+struct spinand_op_batch {
+	struct spi_mem_op ops[SPINAND_MAX_BATCH_OPS];
+	u8 regs[SPINAND_MAX_BATCH_OPS];
+	struct spi_mem_data_seg segs[SPINAND_MAX_BATCH_OPS]
+				    [SPINAND_MAX_CACHE_SEGS];
+	unsigned int nops;
+	bool busy;
+	enum spinand_busy_op busy_op;
+};
+
+static u64 spinand_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void spinand_busy_start(struct spinand_device *spinand,
+			       enum spinand_busy_op busy_op)
+{
+	if (!spinand->busy_state)
+		return;
+
+	spinand->busy_state[spinand->cur_target].op = busy_op;
+	spinand->busy_state[spinand->cur_target].start_us = spinand_time_us();
+}
+
+/*
+ * Operations without response issued between spinand_batch_begin() and
+ * spinand_batch_end() are queued and sent together, saving a round trip
+ * per operation on controllers implementing ->exec_ops(). Anything which
+ * needs an answer from the chip flushes the queue first.
+ */
+static void spinand_batch_begin(struct spinand_device *spinand,
+				struct spinand_op_batch *batch)
+{
+	batch->nops = 0;
+	batch->busy = false;
+	spinand->batch = batch;
+}
+
+static int spinand_batch_flush(struct spinand_device *spinand)
+{
+	struct spinand_op_batch *batch = spinand->batch;
+	int ret;
+
+	if (!batch || !batch->nops)
+		return 0;
+
+	ret = spi_mem_exec_ops(spinand->spimem, batch->ops, batch->nops);
+	batch->nops = 0;
+	if (!ret && batch->busy)
+		spinand_busy_start(spinand, batch->busy_op);
+
+	batch->busy = false;
+	return ret;
+}
+
+/* Close the batch, sending what it holds unless @err tells to drop it. */
+static int spinand_batch_end(struct spinand_device *spinand, int err)
+{
+	if (!err)
+		err = spinand_batch_flush(spinand);
+
+	spinand->batch = NULL;
+	return err;
+}
+
+static int spinand_exec_op(struct spinand_device *spinand,
+			   const struct spi_mem_op *op)
+{
+	struct spinand_op_batch *batch = spinand->batch;
+	int ret;
+
+	if (!batch)
+		return spi_mem_exec_op(spinand->spimem, op);
+
+	if (batch->nops == SPINAND_MAX_BATCH_OPS) {
+		ret = spinand_batch_flush(spinand);
+		if (ret)
+			return ret;
+	}
+
+	batch->ops[batch->nops++] = *op;
+	return 0;
+}
+
 static int spinand_read_reg_op(struct spinand_device *spinand, u8 reg, u8 *val)
 {
 	struct spi_mem_op op = SPINAND_GET_FEATURE_OP(reg,
 						      spinand->scratchbuf);
 	int ret;
 
+	ret = spinand_batch_flush(spinand);
+	if (ret)
+		return ret;
+
 	ret = spi_mem_exec_op(spinand->spimem, &op);
 	if (ret)
 		return ret;
@@ -32,11 +138,23 @@ static int spinand_read_reg_op(struct spinand_device *spinand, u8 reg, u8 *val)
 
 static int spinand_write_reg_op(struct spinand_device *spinand, u8 reg, u8 val)
 {
+	struct spinand_op_batch *batch = spinand->batch;
 	struct spi_mem_op op = SPINAND_SET_FEATURE_OP(reg,
 						      spinand->scratchbuf);
+	int ret;
+
+	if (batch) {
+		if (batch->nops == SPINAND_MAX_BATCH_OPS) {
+			ret = spinand_batch_flush(spinand);
+			if (ret)
+				return ret;
+		}
 
-	*spinand->scratchbuf = val;
-	return spi_mem_exec_op(spinand->spimem, &op);
+		op.data.buf.out = &batch->regs[batch->nops];
+	}
+
+	*(u8 *)op.data.buf.out = val;
+	return spinand_exec_op(spinand, &op);
 }
 
 static int spinand_read_status(struct spinand_device *spinand, u8 *status)
@@ -44,6 +162,43 @@ static int spinand_read_status(struct spinand_device *spinand, u8 *status)
 	return spinand_read_reg_op(spinand, REG_STATUS, status);
 }
 
+/*
+ * Most status samples read in a single GET FEATURE. Also the size of the
+ * scratch buffer.
+ */
+#define SPINAND_STATUS_BURST_MAX	512
+
+/*
+ * Chips flagged with SPINAND_HAS_CONT_STATUS keep shifting the status
+ * register out for as long as CS stays asserted after GET FEATURE. Sample it
+ * up to @nsamples times in a single operation and return the first sample
+ * without STATUS_BUSY, or the last one if the chip stayed busy all along.
+ */
+static int spinand_read_status_burst(struct spinand_device *spinand,
+				     unsigned int nsamples, u8 *status)
+{
+	struct spi_mem_op op = SPINAND_GET_FEATURE_OP(REG_STATUS,
+						      spinand->scratchbuf);
+	unsigned int i;
+	int ret;
+
+	op.data.nbytes = nsamples;
+	ret = spi_mem_adjust_op_size(spinand->spimem, &op);
+	if (ret)
+		return ret;
+
+	ret = spi_mem_exec_op(spinand->spimem, &op);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < op.data.nbytes - 1; i++)
+		if (!(spinand->scratchbuf[i] & STATUS_BUSY))
+			break;
+
+	*status = spinand->scratchbuf[i];
+	return 0;
+}
+
 static int spinand_get_cfg(struct spinand_device *spinand, u8 *cfg)
 {
 	struct nand_device *nand = spinand_to_nand(spinand);
@@ -190,7 +345,32 @@ static int spinand_write_enable_op(struct spinand_device *spinand)
 {
 	struct spi_mem_op op = SPINAND_WR_EN_DIS_OP(true);
 
-	return spi_mem_exec_op(spinand->spimem, &op);
+	return spinand_exec_op(spinand, &op);
+}
+
+/*
+ * Issue an operation after which the chip stays busy, and remember when it
+ * was started so that spinand_wait() knows how long it still has to wait,
+ * even if other dies have been served in the meantime.
+ */
+static int spinand_exec_busy_op(struct spinand_device *spinand,
+				const struct spi_mem_op *op,
+				enum spinand_busy_op busy_op)
+{
+	int ret;
+
+	ret = spinand_exec_op(spinand, op);
+	if (ret)
+		return ret;
+
+	if (spinand->batch) {
+		spinand->batch->busy = true;
+		spinand->batch->busy_op = busy_op;
+		return 0;
+	}
+
+	spinand_busy_start(spinand, busy_op);
+	return 0;
 }
 
 static int spinand_load_page_op(struct spinand_device *spinand,
@@ -200,48 +380,132 @@ static int spinand_load_page_op(struct spinand_device *spinand,
 	unsigned int row = nanddev_pos_to_row(nand, &req->pos);
 	struct spi_mem_op op = SPINAND_PAGE_READ_OP(row);
 
-	return spi_mem_exec_op(spinand->spimem, &op);
+	return spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_READ);
 }
 
-static int spinand_read_from_cache_op(struct spinand_device *spinand,
-				      const struct nand_page_io_req *req)
+static int spinand_read_cache_seq_op(struct spinand_device *spinand)
+{
+	struct spi_mem_op op = SPINAND_PAGE_READ_CACHE_SEQ_OP;
+
+	return spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_READ_CACHE);
+}
+
+static int spinand_read_cache_last_op(struct spinand_device *spinand)
+{
+	struct spi_mem_op op = SPINAND_PAGE_READ_CACHE_LAST_OP;
+
+	return spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_READ_CACHE);
+}
+
+/* Append a segment to a list, merging it with the last one when adjacent. */
+static void spinand_seg_add(struct spi_mem_data_seg *segs, unsigned int *nsegs,
+			    const void *buf, unsigned int nbytes)
+{
+	struct spi_mem_data_seg *last = *nsegs ? &segs[*nsegs - 1] : NULL;
+
+	if (!nbytes)
+		return;
+
+	if (last && last->buf.out + last->nbytes == buf) {
+		last->nbytes += nbytes;
+		return;
+	}
+
+	segs[*nsegs].buf.out = buf;
+	segs[*nsegs].nbytes = nbytes;
+	(*nsegs)++;
+}
+
+/* Drop the first @nbytes bytes of a segment list. */
+static void spinand_segs_advance(struct spi_mem_data_seg **segs,
+				 unsigned int *nsegs, size_t nbytes)
+{
+	while (*nsegs && nbytes >= (*segs)->nbytes) {
+		nbytes -= (*segs)->nbytes;
+		(*segs)++;
+		(*nsegs)--;
+	}
+
+	if (*nsegs) {
+		(*segs)->buf.in += nbytes;
+		(*segs)->nbytes -= nbytes;
+	}
+}
+
+/*
+ * Build the segment list receiving the cache range spanned by @req, which
+ * is returned in [@start, @end). @bounce tells whether the range goes
+ * through the page buffer, to be copied out with spinand_read_unbounce().
+ */
+static unsigned int spinand_read_segs(struct spinand_device *spinand,
+				      const struct nand_page_io_req *req,
+				      struct spi_mem_data_seg *segs,
+				      unsigned int *start, unsigned int *end,
+				      bool *bounce)
 {
 	struct nand_device *nand = spinand_to_nand(spinand);
-	struct spi_mem_dirmap_desc *rdesc;
-	unsigned int nbytes = 0;
-	void *buf = NULL;
-	u16 column = 0;
-	ssize_t ret;
+	unsigned int nsegs = 0;
+	u16 column;
 
+	*bounce = false;
+	*end = 0;
+
+	/*
+	 * Only transfer the column range spanned by the request. The page
+	 * buffer layout matches the cache layout, so the data ends up at the
+	 * same place as with a full page transfer.
+	 */
+	*start = nanddev_page_size(nand) + nanddev_per_page_oobsize(nand);
 	if (req->datalen) {
-		buf = spinand->databuf;
-		nbytes = nanddev_page_size(nand);
-		column = 0;
+		*start = req->dataoffs;
+		*end = req->dataoffs + req->datalen;
 	}
 
 	if (req->ooblen) {
-		nbytes += nanddev_per_page_oobsize(nand);
-		if (!buf) {
-			buf = spinand->oobbuf;
-			column = nanddev_page_size(nand);
-		}
+		column = nanddev_page_size(nand) + req->ooboffs;
+		if (column < *start)
+			*start = column;
+		if (column + req->ooblen > *end)
+			*end = column + req->ooblen;
 	}
 
-	rdesc = spinand->dirmaps[req->pos.plane].rdesc;
+	if (*end <= *start) {
+		*end = *start;
+		return 0;
+	}
 
-	while (nbytes) {
-		ret = spi_mem_dirmap_read(rdesc, column, nbytes, buf);
-		if (ret < 0)
-			return ret;
+	/*
+	 * Transfer straight into the caller buffers. Bytes between the data
+	 * and OOB parts land in the page buffer. Controllers unable to
+	 * scatter the data get the whole range through the page buffer
+	 * instead, unless it maps to a single contiguous area of the caller
+	 * buffers.
+	 */
+	if (req->datalen)
+		spinand_seg_add(segs, &nsegs, req->databuf.in, req->datalen);
 
-		if (!ret || ret > nbytes)
-			return -EIO;
+	if (req->datalen && req->ooblen)
+		spinand_seg_add(segs, &nsegs,
+				spinand->databuf + req->dataoffs + req->datalen,
+				nanddev_page_size(nand) + req->ooboffs -
+				req->dataoffs - req->datalen);
 
-		nbytes -= ret;
-		column += ret;
-		buf += ret;
+	if (req->ooblen)
+		spinand_seg_add(segs, &nsegs, req->oobbuf.in, req->ooblen);
+
+	if (nsegs > 1 && !spinand->spimem->data_segs) {
+		nsegs = 0;
+		*bounce = true;
+		spinand_seg_add(segs, &nsegs, spinand->databuf + *start,
+				*end - *start);
 	}
 
+	return nsegs;
+}
+
+static void spinand_read_unbounce(struct spinand_device *spinand,
+				  const struct nand_page_io_req *req)
+{
 	if (req->datalen)
 		memcpy(req->databuf.in, spinand->databuf + req->dataoffs,
 		       req->datalen);
@@ -249,18 +513,236 @@ static int spinand_read_from_cache_op(struct spinand_device *spinand,
 	if (req->ooblen)
 		memcpy(req->oobbuf.in, spinand->oobbuf + req->ooboffs,
 		       req->ooblen);
+}
+
+static int spinand_read_from_cache_op(struct spinand_device *spinand,
+				      const struct nand_page_io_req *req)
+{
+	struct spi_mem_data_seg segs[SPINAND_MAX_CACHE_SEGS], *seg;
+	struct spi_mem_dirmap_desc *rdesc;
+	unsigned int column, end, nsegs;
+	bool bounce;
+	ssize_t ret;
+
+	nsegs = spinand_read_segs(spinand, req, segs, &column, &end, &bounce);
+	rdesc = spinand->dirmaps[req->pos.plane].rdesc;
+	seg = segs;
+
+	while (nsegs) {
+		ret = spi_mem_dirmap_readv(rdesc, column, seg, nsegs);
+		if (ret < 0)
+			return ret;
+
+		if (!ret || ret > end - column)
+			return -EIO;
+
+		column += ret;
+		spinand_segs_advance(&seg, &nsegs, ret);
+	}
+
+	if (bounce)
+		spinand_read_unbounce(spinand, req);
+
+	return 0;
+}
+
+/*
+ * Set @op up as a single READ FROM CACHE transferring the range spanned by
+ * @req, to be run along with the PAGE READ. Returns -EOPNOTSUPP if the
+ * controller can't transfer the range at once.
+ */
+static int spinand_init_read_from_cache_op(struct spinand_device *spinand,
+					   const struct nand_page_io_req *req,
+					   struct spi_mem_op *op,
+					   struct spi_mem_data_seg *segs,
+					   bool *bounce)
+{
+	struct spi_mem_dirmap_desc *rdesc;
+	unsigned int start, end, nsegs;
+	struct spi_mem_op tmp;
+	int ret;
+
+	nsegs = spinand_read_segs(spinand, req, segs, &start, &end, bounce);
+	rdesc = spinand->dirmaps[req->pos.plane].rdesc;
+
+	*op = rdesc->info.op_tmpl;
+	op->addr.val = rdesc->info.offset + start;
+	op->data.buf.in = NULL;
+	op->data.segs = segs;
+	op->data.nsegs = nsegs;
+	op->data.nbytes = end - start;
+
+	tmp = *op;
+	ret = spi_mem_adjust_op_size(spinand->spimem, &tmp);
+	if (ret)
+		return ret;
+
+	return tmp.data.nbytes < op->data.nbytes ? -EOPNOTSUPP : 0;
+}
+
+/*
+ * Write through a direct mapping. While a batch is open, the operation is
+ * queued instead, unless the controller implements the mapping natively.
+ */
+static ssize_t spinand_dirmap_write(struct spinand_device *spinand,
+				    struct spi_mem_dirmap_desc *desc,
+				    u64 offs,
+				    const struct spi_mem_data_seg *segs,
+				    unsigned int nsegs)
+{
+	struct spinand_op_batch *batch = spinand->batch;
+	struct spi_mem_op op = desc->info.op_tmpl;
+	unsigned int i;
+	int ret;
+
+	if (!batch || !desc->nodirmap) {
+		ret = spinand_batch_flush(spinand);
+		if (ret)
+			return ret;
+
+		return spi_mem_dirmap_writev(desc, offs, segs, nsegs);
+	}
+
+	if (batch->nops == SPINAND_MAX_BATCH_OPS) {
+		ret = spinand_batch_flush(spinand);
+		if (ret)
+			return ret;
+	}
+
+	/* The segment list has to live until the batch is sent. */
+	memcpy(batch->segs[batch->nops], segs, nsegs * sizeof(*segs));
+	op.addr.val = desc->info.offset + offs;
+	op.data.segs = batch->segs[batch->nops];
+	op.data.nsegs = nsegs;
+	op.data.nbytes = 0;
+	for (i = 0; i < nsegs; i++)
+		op.data.nbytes += segs[i].nbytes;
+
+	ret = spi_mem_adjust_op_size(spinand->spimem, &op);
+	if (ret)
+		return ret;
+
+	ret = spinand_exec_op(spinand, &op);
+	if (ret)
+		return ret;
+
+	return op.data.nbytes;
+}
+
+static int spinand_load_cache_segs(struct spinand_device *spinand,
+				   const struct nand_page_io_req *req,
+				   unsigned int column,
+				   struct spi_mem_data_seg *segs,
+				   unsigned int nsegs, bool reset)
+{
+	struct spinand_dirmap *dirmap = &spinand->dirmaps[req->pos.plane];
+	struct spi_mem_dirmap_desc *wdesc;
+	size_t nbytes = 0;
+	unsigned int i;
+	ssize_t ret;
+
+	wdesc = reset ? dirmap->wdesc_reset : dirmap->wdesc;
+
+	for (i = 0; i < nsegs; i++)
+		nbytes += segs[i].nbytes;
+
+	while (nsegs) {
+		ret = spinand_dirmap_write(spinand, wdesc, column, segs, nsegs);
+		if (ret < 0)
+			return ret;
+
+		if (!ret || (size_t)ret > nbytes)
+			return -EIO;
+
+		nbytes -= ret;
+		column += ret;
+		spinand_segs_advance(&segs, &nsegs, ret);
+
+		/* Only the first chunk may reset the cache. */
+		wdesc = dirmap->wdesc;
+	}
 
 	return 0;
 }
 
+static int spinand_load_cache(struct spinand_device *spinand,
+			      const struct nand_page_io_req *req,
+			      unsigned int column, unsigned int nbytes,
+			      const void *buf, bool reset)
+{
+	struct spi_mem_data_seg seg = {
+		.buf.out = buf,
+		.nbytes = nbytes,
+	};
+
+	return spinand_load_cache_segs(spinand, req, column, &seg,
+				       nbytes ? 1 : 0, reset);
+}
+
+/* Add the [@from, @to) cache range, filled with 0xff, to a segment list. */
+static void spinand_seg_add_blank(struct spinand_device *spinand,
+				  struct spi_mem_data_seg *segs,
+				  unsigned int *nsegs, unsigned int from,
+				  unsigned int to)
+{
+	if (to <= from)
+		return;
+
+	memset(spinand->databuf + from, 0xff, to - from);
+	spinand_seg_add(segs, nsegs, spinand->databuf + from, to - from);
+}
+
 static int spinand_write_to_cache_op(struct spinand_device *spinand,
 				     const struct nand_page_io_req *req)
 {
 	struct nand_device *nand = spinand_to_nand(spinand);
-	struct spi_mem_dirmap_desc *wdesc;
-	unsigned int nbytes, column = 0;
-	void *buf = spinand->databuf;
-	ssize_t ret;
+	unsigned int page_size = nanddev_page_size(nand);
+	unsigned int oob_size = nanddev_per_page_oobsize(nand);
+	unsigned int oobstart = page_size + req->ooboffs;
+	struct spi_mem_data_seg segs[SPINAND_MAX_CACHE_SEGS];
+	bool scatter = spinand->spimem->data_segs;
+	unsigned int nsegs = 0, pos = 0;
+	int ret;
+
+	/*
+	 * On chips where PROGRAM LOAD resets the whole cache to 0xFF, only
+	 * the bytes we actually want to program have to be sent: the first
+	 * span is loaded with PROGRAM LOAD and the second one, if the data
+	 * and OOB parts are not adjacent in the cache or can't be gathered,
+	 * with RANDOM DATA PROGRAM LOAD.
+	 */
+	if ((spinand->flags & SPINAND_HAS_PROG_LOAD_RESET) &&
+	    (req->datalen || req->ooblen)) {
+		if (!req->ooblen)
+			return spinand_load_cache(spinand, req, req->dataoffs,
+						  req->datalen,
+						  req->databuf.out, true);
+
+		if (!req->datalen)
+			return spinand_load_cache(spinand, req, oobstart,
+						  req->ooblen,
+						  req->oobbuf.out, true);
+
+		if (req->dataoffs + req->datalen == oobstart) {
+			spinand_seg_add(segs, &nsegs, req->databuf.out,
+					req->datalen);
+			spinand_seg_add(segs, &nsegs, req->oobbuf.out,
+					req->ooblen);
+			if (nsegs == 1 || scatter)
+				return spinand_load_cache_segs(spinand, req,
+							       req->dataoffs,
+							       segs, nsegs,
+							       true);
+		}
+
+		ret = spinand_load_cache(spinand, req, req->dataoffs,
+					 req->datalen, req->databuf.out, true);
+		if (ret)
+			return ret;
+
+		return spinand_load_cache(spinand, req, oobstart, req->ooblen,
+					  req->oobbuf.out, false);
+	}
 
 	/*
 	 * Looks like PROGRAM LOAD (AKA write cache) does not necessarily reset
@@ -268,9 +750,29 @@ static int spinand_write_to_cache_op(struct spinand_device *spinand,
 	 * must fill the page cache entirely even if we only want to program
 	 * the data portion of the page, otherwise we might corrupt the BBM or
 	 * user data previously programmed in OOB area.
+	 *
+	 * The data and OOB parts are sent from the caller buffers, the 0xFF
+	 * areas around them from the page buffer.
 	 */
-	nbytes = nanddev_page_size(nand) + nanddev_per_page_oobsize(nand);
-	memset(spinand->databuf, 0xff, nbytes);
+	if (req->datalen) {
+		spinand_seg_add_blank(spinand, segs, &nsegs, pos,
+				      req->dataoffs);
+		spinand_seg_add(segs, &nsegs, req->databuf.out, req->datalen);
+		pos = req->dataoffs + req->datalen;
+	}
+
+	if (req->ooblen) {
+		spinand_seg_add_blank(spinand, segs, &nsegs, pos, oobstart);
+		spinand_seg_add(segs, &nsegs, req->oobbuf.out, req->ooblen);
+		pos = oobstart + req->ooblen;
+	}
+
+	spinand_seg_add_blank(spinand, segs, &nsegs, pos,
+			      page_size + oob_size);
+
+	if (nsegs == 1 || scatter)
+		return spinand_load_cache_segs(spinand, req, 0, segs, nsegs,
+					       false);
 
 	if (req->datalen)
 		memcpy(spinand->databuf + req->dataoffs, req->databuf.out,
@@ -280,224 +782,1288 @@ static int spinand_write_to_cache_op(struct spinand_device *spinand,
 		memcpy(spinand->oobbuf + req->ooboffs, req->oobbuf.out,
 		       req->ooblen);
 
-	wdesc = spinand->dirmaps[req->pos.plane].wdesc;
+	return spinand_load_cache(spinand, req, 0, page_size + oob_size,
+				  spinand->databuf, false);
+}
+
+static int spinand_program_op(struct spinand_device *spinand,
+			      const struct nand_page_io_req *req)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	unsigned int row = nanddev_pos_to_row(nand, &req->pos);
+	struct spi_mem_op op = SPINAND_PROG_EXEC_OP(row);
+
+	return spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_PROG);
+}
+
+static int spinand_erase_op(struct spinand_device *spinand,
+			    const struct nand_pos *pos)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	unsigned int row = nanddev_pos_to_row(nand, pos);
+	struct spi_mem_op op = SPINAND_BLK_ERASE_OP(row);
+
+	return spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_ERASE);
+}
+
+/*
+ * Host and transport latency allowed on top of the maximum busy time of an
+ * operation before giving up on it.
+ */
+#define SPINAND_WAIT_SLACK_US		100000
+
+/*
+ * Sleeping for less than this costs more than it saves: the remaining time
+ * is spent polling instead.
+ */
+#define SPINAND_WAIT_MIN_SLEEP_US	50
+
+/*
+ * Poll the status register until the chip is ready or @deadline is reached.
+ * This is left to spi_mem_poll_status(), which hands it over to controllers
+ * able to poll on their side, except for chips shifting the status out
+ * continuously behind a controller which can't: those are polled with bursts
+ * of samples, growing as long as the chip stays busy.
+ */
+static int spinand_poll_status(struct spinand_device *spinand, u64 deadline,
+			       u8 *status)
+{
+	struct spi_mem_op op = SPINAND_GET_FEATURE_OP(REG_STATUS,
+						      spinand->scratchbuf);
+	unsigned int burst = 8;
+	u64 now = spinand_time_us();
+	int ret;
+
+	if (!(spinand->flags & SPINAND_HAS_CONT_STATUS) ||
+	    spi_mem_can_poll_status(spinand->spimem)) {
+		ret = spi_mem_poll_status(spinand->spimem, &op, STATUS_BUSY, 0,
+					  0, 0,
+					  now < deadline ?
+					  (deadline - now + 999) / 1000 : 0);
+		*status = *spinand->scratchbuf;
+		return ret;
+	}
+
+	do {
+		ret = spinand_read_status_burst(spinand, burst, status);
+		if (ret)
+			return ret;
+
+		if (!(*status & STATUS_BUSY))
+			return 0;
+
+		if (burst < SPINAND_STATUS_BURST_MAX)
+			burst *= 8;
+	} while (spinand_time_us() < deadline);
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Wait for the operation in progress on the current die to complete.
+ *
+ * The chip isn't polled right away: we first sleep until the operation is
+ * expected to be done and only then check the status register. The expected
+ * busy time starts from the datasheet typical value and follows the
+ * completions actually observed: it is raised towards the measured time when
+ * the chip had to be polled, and lowered a bit when it was already ready at
+ * the first check, since it may then have been ready earlier.
+ */
+static int spinand_wait(struct spinand_device *spinand, u8 *s)
+{
+	enum spinand_busy_op busy_op = SPINAND_BUSY_RESET;
+	u64 start, now, elapsed, timeout;
+	bool slept = false;
+	u32 *est;
+	u8 status;
+	int ret;
+
+	now = spinand_time_us();
+	start = now;
+	if (spinand->busy_state) {
+		busy_op = spinand->busy_state[spinand->cur_target].op;
+		start = spinand->busy_state[spinand->cur_target].start_us;
+	}
+
+	est = &spinand->busy[busy_op].est_us;
+	timeout = spinand->busy[busy_op].timing.max_us + SPINAND_WAIT_SLACK_US;
+
+	elapsed = now - start;
+	if (*est >= elapsed + SPINAND_WAIT_MIN_SLEEP_US) {
+		struct timespec ts = {
+			.tv_sec = (*est - elapsed) / 1000000,
+			.tv_nsec = (*est - elapsed) % 1000000 * 1000,
+		};
+
+		nanosleep(&ts, NULL);
+		slept = true;
+	}
+
+	ret = spinand_read_status(spinand, &status);
+	if (ret)
+		return ret;
+
+	if (!(status & STATUS_BUSY)) {
+		if (slept)
+			*est -= *est / 8;
+		goto out;
+	}
+
+	ret = spinand_poll_status(spinand, start + timeout, &status);
+	if (ret == -ETIMEDOUT) {
+		/*
+		 * Extra read, just in case the STATUS_READY bit has changed
+		 * since our last check
+		 */
+		ret = spinand_read_status(spinand, &status);
+	}
+	if (ret)
+		return ret;
+
+	if (!(status & STATUS_BUSY)) {
+		elapsed = spinand_time_us() - start;
+		*est += ((s64)elapsed - *est) / 4;
+	}
+
+out:
+	if (s)
+		*s = status;
+
+	return status & STATUS_BUSY ? -ETIMEDOUT : 0;
+}
+
+/*
+ * Whether the open batch ends with an operation leaving the chip busy, and
+ * the controller can wait for it and run the following operations on its
+ * side.
+ */
+static bool spinand_batch_can_offload(struct spinand_device *spinand)
+{
+	return spinand->batch->busy &&
+	       spi_mem_can_exec_ops_poll(spinand->spimem);
+}
+
+/*
+ * Close a batch ending with an operation which leaves the chip busy, wait
+ * for the chip and run @post. When spinand_batch_can_offload(), all of it is
+ * handed over to the controller as a single request, the chip being polled
+ * right away.
+ */
+static int spinand_batch_end_wait(struct spinand_device *spinand,
+				  const struct spi_mem_op *post,
+				  unsigned int npost, u8 *status)
+{
+	struct spinand_op_batch *batch = spinand->batch;
+	struct spi_mem_op op = SPINAND_GET_FEATURE_OP(REG_STATUS,
+						      spinand->scratchbuf);
+	u64 timeout;
+	int ret;
+
+	if (!spinand_batch_can_offload(spinand)) {
+		ret = spinand_batch_end(spinand, 0);
+		if (!ret)
+			ret = spinand_wait(spinand, status);
+		if (!ret && npost)
+			ret = spi_mem_exec_ops(spinand->spimem, post, npost);
+		return ret;
+	}
+
+	timeout = spinand->busy[batch->busy_op].timing.max_us +
+		  SPINAND_WAIT_SLACK_US;
+	ret = spi_mem_exec_ops_poll(spinand->spimem, batch->ops, batch->nops,
+				    &op, STATUS_BUSY, 0,
+				    (timeout + 999) / 1000, post, npost);
+	batch->nops = 0;
+	batch->busy = false;
+	spinand->batch = NULL;
+
+	*status = *spinand->scratchbuf;
+	return ret;
+}
+
+/*
+ * Used until the chip is identified, and for chips without timings in their
+ * table entry. RESET and cache reads are short enough to be polled right
+ * away, their timeout is the wait slack alone until the chip timings are
+ * known.
+ */
+static const struct spinand_timings spinand_default_timings = {
+	.tr = { 25, 400000 },
+	.tprog = { 250, 400000 },
+	.tbers = { 2000, 400000 },
+};
+
+/*
+ * Set up the busy time model from the chip timings. Operations the timings
+ * don't cover keep their previous, generic, values.
+ */
+static void spinand_init_busy(struct spinand_device *spinand,
+			      const struct spinand_timings *timings)
+{
+	const struct spinand_op_timing *t[SPINAND_NUM_BUSY_OPS] = {
+		[SPINAND_BUSY_READ] = &timings->tr,
+		[SPINAND_BUSY_PROG] = &timings->tprog,
+		[SPINAND_BUSY_ERASE] = &timings->tbers,
+	};
+	unsigned int i;
+
+	for (i = 0; i < SPINAND_NUM_BUSY_OPS; i++) {
+		if (!t[i] || !t[i]->max_us)
+			continue;
+
+		spinand->busy[i].timing = *t[i];
+		spinand->busy[i].est_us = t[i]->typ_us;
+	}
+
+	/*
+	 * A cache read waits for the page read it follows, it can't take
+	 * longer than a page read.
+	 */
+	if (timings->tr.max_us)
+		spinand->busy[SPINAND_BUSY_READ_CACHE].timing.max_us =
+			timings->tr.max_us;
+}
+
+static int spinand_read_id_op(struct spinand_device *spinand, u8 naddr,
+			      u8 ndummy, u8 *buf)
+{
+	struct spi_mem_op op = SPINAND_READID_OP(
+		naddr, ndummy, spinand->scratchbuf, SPINAND_MAX_ID_LEN);
+	int ret;
+
+	ret = spi_mem_exec_op(spinand->spimem, &op);
+	if (!ret)
+		memcpy(buf, spinand->scratchbuf, SPINAND_MAX_ID_LEN);
+
+	return ret;
+}
+
+static int spinand_reset_op(struct spinand_device *spinand)
+{
+	struct spi_mem_op op = SPINAND_RESET_OP;
+	int ret;
+
+	ret = spinand_exec_busy_op(spinand, &op, SPINAND_BUSY_RESET);
+	if (ret)
+		return ret;
+
+	return spinand_wait(spinand, NULL);
+}
+
+static int spinand_lock_block(struct spinand_device *spinand, u8 lock)
+{
+	return spinand_write_reg_op(spinand, REG_BLOCK_LOCK, lock);
+}
+
+static int spinand_check_ecc_status(struct spinand_device *spinand, u8 status)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+
+	if (spinand->eccinfo.get_status)
+		return spinand->eccinfo.get_status(spinand, status);
+
+	switch (status & STATUS_ECC_MASK) {
+	case STATUS_ECC_NO_BITFLIPS:
+		return 0;
+
+	case STATUS_ECC_HAS_BITFLIPS:
+		/*
+		 * We have no way to know exactly how many bitflips have been
+		 * fixed, so let's return the maximum possible value so that
+		 * wear-leveling layers move the data immediately.
+		 */
+		return nand->eccreq.strength;
+
+	case STATUS_ECC_UNCOR_ERROR:
+		return -EBADMSG;
+
+	default:
+		break;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Terminate an ongoing sequential cache read. The page pending in the data
+ * register is moved to the cache and dropped, leaving the chip ready for
+ * any other command.
+ */
+static int spinand_seq_read_end(struct spinand_device *spinand)
+{
+	int ret;
+
+	if (!spinand->seq_read.active)
+		return 0;
+
+	spinand->seq_read.active = false;
+
+	ret = spinand_read_cache_last_op(spinand);
+	if (ret)
+		return ret;
+
+	return spinand_wait(spinand, NULL);
+}
+
+static bool spinand_seq_read_possible(struct spinand_device *spinand,
+				      const struct nand_pos *pos,
+				      const struct nand_pos *next)
+{
+	if (!(spinand->flags & SPINAND_HAS_READ_CACHE_SEQ))
+		return false;
+
+	/*
+	 * READ PAGE CACHE SEQUENTIAL always loads the following row. Don't
+	 * let the sequence cross an eraseblock boundary so that the plane
+	 * doesn't change under our feet on multi-plane chips.
+	 */
+	return next->target == pos->target && next->lun == pos->lun &&
+	       next->eraseblock == pos->eraseblock &&
+	       next->page == pos->page + 1;
+}
+
+static void spinand_read_complete(void *arg, int ret)
+{
+	int *xfer_ret = arg;
+
+	if (ret)
+		*xfer_ret = ret;
+}
+
+/*
+ * Read the range of @req out of the cache. With @xfer_ret set, the READ FROM
+ * CACHE is submitted to the spi-mem queue instead, when the controller takes
+ * it as a single transfer straight into the caller buffer. It then goes out
+ * along with the following operations, and its error, if any, is stored in
+ * *@xfer_ret once it completed.
+ */
+static int spinand_read_from_cache_submit(struct spinand_device *spinand,
+					  const struct nand_page_io_req *req,
+					  int *xfer_ret)
+{
+	struct spi_mem_data_seg segs[SPINAND_MAX_CACHE_SEGS];
+	struct spi_mem_op op;
+	bool bounce;
+	int ret;
+
+	if (!xfer_ret ||
+	    spinand_init_read_from_cache_op(spinand, req, &op, segs, &bounce) ||
+	    bounce || op.data.nsegs != 1)
+		return spinand_read_from_cache_op(spinand, req);
+
+	/* The segment list doesn't outlive this call, the buffer does. */
+	op.data.buf.in = segs[0].buf.in;
+	op.data.segs = NULL;
+	op.data.nsegs = 0;
+
+	ret = spi_mem_submit_op(spinand->spimem, &op, spinand_read_complete,
+				xfer_ret);
+	if (ret != -EOPNOTSUPP)
+		return ret;
+
+	return spinand_read_from_cache_op(spinand, req);
+}
+
+/*
+ * Close the batch ending with the operation which loads the cache, wait for
+ * the chip and read the range of @req out of the cache. Controllers able to
+ * wait for the chip on their side get the READ FROM CACHE within the same
+ * request. Otherwise it may be left in flight, see
+ * spinand_read_from_cache_submit().
+ *
+ * Return: same as spinand_read_page().
+ */
+static int spinand_batch_end_read(struct spinand_device *spinand,
+				  const struct nand_page_io_req *req,
+				  bool ecc_enabled, int *xfer_ret)
+{
+	struct spi_mem_data_seg segs[SPINAND_MAX_CACHE_SEGS];
+	struct spi_mem_op op;
+	bool offload, bounce;
+	u8 status;
+	int ret, ecc = 0;
+
+	offload = spinand_batch_can_offload(spinand) &&
+		  !spinand_init_read_from_cache_op(spinand, req, &op, segs,
+						   &bounce);
+
+	ret = spinand_batch_end_wait(spinand, &op,
+				     offload && op.data.nbytes ? 1 : 0,
+				     &status);
+	if (ret)
+		return ret;
+
+	if (offload && bounce)
+		spinand_read_unbounce(spinand, req);
+
+	/*
+	 * Check the ECC status first: it may take operations of its own,
+	 * which must not wait for a READ FROM CACHE left in flight.
+	 */
+	if (ecc_enabled)
+		ecc = spinand_check_ecc_status(spinand, status);
+
+	if (!offload) {
+		ret = spinand_read_from_cache_submit(spinand, req, xfer_ret);
+		if (ret)
+			return ret;
+	}
+
+	return ecc;
+}
+
+static int spinand_read_page_xfer(struct spinand_device *spinand,
+				  const struct nand_page_io_req *req,
+				  bool ecc_enabled, int *xfer_ret)
+{
+	struct spinand_op_batch batch;
+	int ret;
+
+	ret = spinand_seq_read_end(spinand);
+	if (ret)
+		return ret;
+
+	ret = spinand_select_target(spinand, req->pos.target);
+	if (ret)
+		return ret;
+
+	spinand_batch_begin(spinand, &batch);
+	ret = spinand_ecc_enable(spinand, ecc_enabled);
+	if (!ret)
+		ret = spinand_load_page_op(spinand, req);
+	if (ret)
+		return spinand_batch_end(spinand, ret);
+
+	return spinand_batch_end_read(spinand, req, ecc_enabled, xfer_ret);
+}
+
+int spinand_read_page(struct spinand_device *spinand,
+			     const struct nand_page_io_req *req,
+			     bool ecc_enabled)
+{
+	return spinand_read_page_xfer(spinand, req, ecc_enabled, NULL);
+}
+
+static int spinand_read_page_seq_xfer(struct spinand_device *spinand,
+				      const struct nand_page_io_req *req,
+				      bool ecc_enabled,
+				      const struct nand_pos *next,
+				      int *xfer_ret)
+{
+	bool cont = next && spinand_seq_read_possible(spinand, &req->pos, next);
+	struct spinand_op_batch batch;
+	int ret;
+
+	if (!cont && !spinand->seq_read.active)
+		return spinand_read_page_xfer(spinand, req, ecc_enabled,
+					      xfer_ret);
+
+	if (!spinand->seq_read.active ||
+	    spinand->seq_read.ecc_enabled != ecc_enabled ||
+	    nanddev_pos_cmp(&spinand->seq_read.pos, &req->pos)) {
+		ret = spinand_seq_read_end(spinand);
+		if (ret)
+			return ret;
+
+		if (!cont)
+			return spinand_read_page_xfer(spinand, req,
+						      ecc_enabled, xfer_ret);
+
+		ret = spinand_select_target(spinand, req->pos.target);
+		if (ret)
+			return ret;
+
+		ret = spinand_ecc_enable(spinand, ecc_enabled);
+		if (ret)
+			return ret;
+
+		ret = spinand_load_page_op(spinand, req);
+		if (ret)
+			return ret;
+
+		ret = spinand_wait(spinand, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	/*
+	 * Either move the page to the cache while loading the next one, or
+	 * finish the sequence. The ECC status reflects the page which just
+	 * landed in the cache. Should this fail, ending the sequence later is
+	 * harmless.
+	 */
+	spinand->seq_read.active = cont;
+	if (cont) {
+		spinand->seq_read.ecc_enabled = ecc_enabled;
+		spinand->seq_read.pos = *next;
+	}
+
+	spinand_batch_begin(spinand, &batch);
+	if (cont)
+		ret = spinand_read_cache_seq_op(spinand);
+	else
+		ret = spinand_read_cache_last_op(spinand);
+	if (ret)
+		return spinand_batch_end(spinand, ret);
+
+	return spinand_batch_end_read(spinand, req, ecc_enabled, xfer_ret);
+}
+
+/**
+ * spinand_read_page_seq() - Read a page which is part of a linear read
+ * @spinand: the spinand device
+ * @req: the I/O request
+ * @ecc_enabled: whether on-die ECC should be enabled
+ * @next: position of the page which will be read right after this one, or
+ *	  NULL if @req is the last page of the sequence
+ *
+ * On chips flagged with SPINAND_HAS_READ_CACHE_SEQ, the array load of @next
+ * is started with READ PAGE CACHE SEQUENTIAL before @req is transferred out
+ * of the cache, so tR is hidden behind the bus transfer. The last page is
+ * released with READ PAGE CACHE LAST. Falls back to spinand_read_page() when
+ * the chip or @next doesn't allow a cache read.
+ *
+ * Return: same as spinand_read_page().
+ */
+int spinand_read_page_seq(struct spinand_device *spinand,
+			  const struct nand_page_io_req *req, bool ecc_enabled,
+			  const struct nand_pos *next)
+{
+	return spinand_read_page_seq_xfer(spinand, req, ecc_enabled, next,
+					  NULL);
+}
+
+/*
+ * In continuous read mode the cycles following the opcode are don't care.
+ * Plain READ FROM CACHE has three of them, which is what every vendor
+ * expects, whereas the fast and multi-IO variants need extra dummy cycles
+ * on some chips. So always stream with it.
+ */
+static unsigned int spinand_cont_read_max_pages(struct spinand_device *spinand)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	unsigned int len = nanddev_page_size(nand) *
+			   nanddev_pages_per_eraseblock(nand);
+	struct spi_mem_op op = SPINAND_PAGE_READ_FROM_CACHE_OP(false, 0, 1,
+							       NULL, len);
+
+	if (!spinand->set_cont_read)
+		return 0;
+
+	if (spi_mem_adjust_op_size(spinand->spimem, &op))
+		return 0;
+
+	if (!spi_mem_supports_op(spinand->spimem, &op))
+		return 0;
+
+	return op.data.nbytes / nanddev_page_size(nand);
+}
+
+/**
+ * spinand_cont_read_possible() - Check if spinand_read_cont() can be used
+ * @spinand: the spinand device
+ *
+ * Return: true if both the chip and the controller are able to stream more
+ *	   than one page in a single READ FROM CACHE operation.
+ */
+bool spinand_cont_read_possible(struct spinand_device *spinand)
+{
+	return spinand_cont_read_max_pages(spinand) > 1;
+}
+
+/**
+ * spinand_read_cont() - Read consecutive pages in continuous read mode
+ * @spinand: the spinand device
+ * @pos: position of the first page
+ * @npages: number of pages to read. They must all belong to the eraseblock
+ *	    pointed by @pos
+ * @buf: destination buffer, @npages times the page size. OOB data is not
+ *	 returned in continuous read mode
+ * @ecc_enabled: whether on-die ECC should be enabled
+ *
+ * Switches the chip to continuous read mode, issues a single PAGE READ and
+ * then clocks the pages out with one long READ FROM CACHE, so there is no
+ * per-page command, status polling or re-addressing. The stream is split
+ * (and restarted with another PAGE READ) only when the controller can't
+ * transfer the whole range at once.
+ *
+ * Return: the maximum number of corrected bitflips, -EBADMSG if some data
+ *	   couldn't be corrected, -EOPNOTSUPP if continuous read isn't
+ *	   possible or another negative error code.
+ */
+int spinand_read_cont(struct spinand_device *spinand,
+		      const struct nand_pos *pos, unsigned int npages,
+		      void *buf, bool ecc_enabled)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	unsigned int max_pages = spinand_cont_read_max_pages(spinand);
+	size_t page_size = nanddev_page_size(nand);
+	struct nand_page_io_req req = { .pos = *pos };
+	int ret, max_bitflips = 0;
+	u8 status;
+
+	if (max_pages < 2)
+		return -EOPNOTSUPP;
+
+	if (pos->page + npages > nanddev_pages_per_eraseblock(nand))
+		return -EINVAL;
+
+	ret = spinand_seq_read_end(spinand);
+	if (ret)
+		return ret;
+
+	ret = spinand_select_target(spinand, pos->target);
+	if (ret)
+		return ret;
+
+	ret = spinand_ecc_enable(spinand, ecc_enabled);
+	if (ret)
+		return ret;
+
+	ret = spinand->set_cont_read(spinand, true);
+	if (ret)
+		return ret;
+
+	while (npages) {
+		unsigned int n = npages < max_pages ? npages : max_pages;
+		struct spi_mem_op op =
+			SPINAND_PAGE_READ_FROM_CACHE_OP(false, 0, 1, buf,
+							n * page_size);
+
+		ret = spinand_load_page_op(spinand, &req);
+		if (ret)
+			break;
+
+		ret = spinand_wait(spinand, NULL);
+		if (ret)
+			break;
+
+		ret = spi_mem_exec_op(spinand->spimem, &op);
+		if (ret)
+			break;
+
+		if (ecc_enabled) {
+			/* The ECC status accumulates over the whole stream. */
+			ret = spinand_read_status(spinand, &status);
+			if (ret)
+				break;
+
+			ret = spinand_check_ecc_status(spinand, status);
+			if (ret == -EBADMSG)
+				max_bitflips = ret;
+			else if (ret < 0)
+				break;
+			else if (max_bitflips >= 0 && ret > max_bitflips)
+				max_bitflips = ret;
+			ret = 0;
+		}
+
+		req.pos.page += n;
+		buf += n * page_size;
+		npages -= n;
+	}
+
+	if (ret) {
+		spinand->set_cont_read(spinand, false);
+		return ret;
+	}
+
+	ret = spinand->set_cont_read(spinand, false);
+	if (ret)
+		return ret;
+
+	return max_bitflips;
+}
+
+/**
+ * spinand_read_pages() - Read consecutive pages
+ * @spinand: the spinand device
+ * @pos: position of the first page
+ * @npages: number of pages to read. They may span several eraseblocks and
+ *	    dies
+ * @buf: destination buffer. Each page takes the page size, plus the OOB size
+ *	 if @read_oob is set
+ * @read_oob: whether the OOB area of each page is read as well
+ * @ecc_enabled: whether on-die ECC should be enabled
+ * @results: if not NULL, filled with the result of each page: the number of
+ *	     corrected bitflips or a negative error code
+ *
+ * Runs of pages inside an eraseblock are read in continuous read mode when
+ * the OOB area isn't needed and both the chip and the controller support it,
+ * with sequential cache reads otherwise. A run reporting uncorrectable
+ * errors in continuous read mode is read again page by page, so @results
+ * tells which pages are affected. The READ FROM CACHE of a page is left in
+ * flight while the next page is loaded, on controllers able to queue it.
+ *
+ * Reading goes on after a page failed.
+ *
+ * Return: the maximum number of corrected bitflips, or the error of the
+ *	   first page which failed.
+ */
+int spinand_read_pages(struct spinand_device *spinand,
+		       const struct nand_pos *pos, unsigned int npages,
+		       void *buf, bool read_oob, bool ecc_enabled,
+		       int *results)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	size_t page_size = nanddev_page_size(nand);
+	size_t stride = page_size;
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	struct nand_page_io_req req = { .pos = *pos };
+	struct nand_pos next;
+	unsigned int i, j, n;
+	int ret, res = 0, xfer_ret = 0;
+	bool cont_read;
+
+	req.datalen = page_size;
+	if (read_oob) {
+		req.ooblen = nanddev_per_page_oobsize(nand);
+		stride += req.ooblen;
+	}
+
+	cont_read = !read_oob && spinand_cont_read_possible(spinand);
+
+	for (i = 0; i < npages; i += n) {
+		n = ppb - req.pos.page;
+		if (n > npages - i)
+			n = npages - i;
+
+		if (cont_read && n > 1) {
+			ret = spinand_read_cont(spinand, &req.pos, n,
+						buf + i * stride, ecc_enabled);
+			if (ret == -EOPNOTSUPP) {
+				cont_read = false;
+			} else if (ret != -EBADMSG) {
+				for (j = 0; j < n; j++) {
+					if (results)
+						results[i + j] = ret;
+					nanddev_pos_next_page(nand, &req.pos);
+				}
+				if (res >= 0 && (ret < 0 || ret > res))
+					res = ret;
+				continue;
+			}
+		}
+
+		for (j = i; j < i + n; j++) {
+			req.databuf.in = buf + j * stride;
+			req.oobbuf.in = buf + j * stride + page_size;
+			next = req.pos;
+			nanddev_pos_next_page(nand, &next);
+			ret = spinand_read_page_seq_xfer(spinand, &req,
+					ecc_enabled, j + 1 < npages ? &next : NULL,
+					results ? &results[j] : &xfer_ret);
+			if (results)
+				results[j] = ret;
+			if (res >= 0 && (ret < 0 || ret > res))
+				res = ret;
+			req.pos = next;
+		}
+	}
+
+	/* Collect the cache reads left in flight. */
+	spi_mem_drain(spinand->spimem);
+	if (!results)
+		return res >= 0 && xfer_ret ? xfer_ret : res;
+
+	for (res = 0, j = 0; j < npages && res >= 0; j++)
+		if (results[j] < 0 || results[j] > res)
+			res = results[j];
+
+	return res;
+}
+
+/* Add the whole program sequence of @req to the open batch. */
+static int spinand_queue_program(struct spinand_device *spinand,
+				 const struct nand_page_io_req *req,
+				 bool ecc_enabled)
+{
+	int ret;
+
+	ret = spinand_ecc_enable(spinand, ecc_enabled);
+	if (!ret)
+		ret = spinand_write_enable_op(spinand);
+	if (!ret)
+		ret = spinand_write_to_cache_op(spinand, req);
+	if (!ret)
+		ret = spinand_program_op(spinand, req);
+
+	return ret;
+}
+
+/* Most pages handed over to spi_mem_read_crc32() at once. */
+#define SPINAND_CRC_MAX_PAGES	64
+
+/**
+ * spinand_read_pages_crc32() - Get the CRC32 of consecutive pages
+ * @spinand: the spinand device
+ * @pos: position of the first page
+ * @npages: number of pages. They may span several eraseblocks and dies
+ * @read_oob: whether the OOB area of each page is covered as well
+ * @ecc_enabled: whether on-die ECC should be enabled
+ * @crcs: zlib CRC-32 of each page, covering its data followed by its OOB
+ *	  area if @read_oob is set
+ * @results: result of each page, as for spinand_read_pages(). May be NULL
+ *
+ * The pages are read and checksummed by the controller, only the CRCs are
+ * transferred, e.g. to verify the flash content against an image.
+ *
+ * Return: -EOPNOTSUPP if the controller can't do it, otherwise the maximum
+ *	   number of corrected bitflips or the error of the first page which
+ *	   failed.
+ */
+int spinand_read_pages_crc32(struct spinand_device *spinand,
+			     const struct nand_pos *pos, unsigned int npages,
+			     bool read_oob, bool ecc_enabled, u32 *crcs,
+			     int *results)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	struct spi_mem_op op = SPINAND_GET_FEATURE_OP(REG_STATUS,
+						      spinand->scratchbuf);
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	struct spi_mem_dirmap_desc *rdesc;
+	u8 status[SPINAND_CRC_MAX_PAGES];
+	struct nand_pos cur = *pos;
+	struct spi_mem_op read;
+	unsigned int i, j, n;
+	u64 timeout;
+	int ret, res = 0;
+
+	if (!spi_mem_can_read_crc32(spinand->spimem))
+		return -EOPNOTSUPP;
+
+	ret = spinand_seq_read_end(spinand);
+	if (ret)
+		return ret;
+
+	timeout = spinand->busy[SPINAND_BUSY_READ].timing.max_us +
+		  SPINAND_WAIT_SLACK_US;
+
+	for (i = 0; i < npages; i += n) {
+		struct spi_mem_op load =
+			SPINAND_PAGE_READ_OP(nanddev_pos_to_row(nand, &cur));
+
+		/* Stay within an eraseblock, so that the plane is the same. */
+		n = ppb - cur.page;
+		if (n > npages - i)
+			n = npages - i;
+		if (n > SPINAND_CRC_MAX_PAGES)
+			n = SPINAND_CRC_MAX_PAGES;
+
+		ret = spinand_select_target(spinand, cur.target);
+		if (!ret)
+			ret = spinand_ecc_enable(spinand, ecc_enabled);
+		if (ret)
+			return ret;
+
+		rdesc = spinand->dirmaps[cur.plane].rdesc;
+		read = rdesc->info.op_tmpl;
+		read.addr.val = rdesc->info.offset;
+		read.data.buf.in = spinand->databuf;
+		read.data.nbytes = nanddev_page_size(nand);
+		if (read_oob)
+			read.data.nbytes += nanddev_per_page_oobsize(nand);
+
+		ret = spi_mem_read_crc32(spinand->spimem, &load, n, &op,
+					 STATUS_BUSY, 0, (timeout + 999) / 1000,
+					 &read, crcs + i, status);
+		if (ret)
+			return ret;
+
+		for (j = 0; j < n; j++) {
+			if (status[j] & STATUS_BUSY)
+				ret = -ETIMEDOUT;
+			else if (ecc_enabled)
+				ret = spinand_check_ecc_status(spinand,
+							       status[j]);
+			else
+				ret = 0;
+
+			if (results)
+				results[i + j] = ret;
+			if (res >= 0 && (ret < 0 || ret > res))
+				res = ret;
+			nanddev_pos_next_page(nand, &cur);
+		}
+	}
+
+	return res;
+}
+
+/**
+ * spinand_write_page_start() - Start programming a page
+ * @spinand: the spinand device
+ * @req: the I/O request
+ * @ecc_enabled: whether on-die ECC should be enabled
+ *
+ * Loads the cache and issues PROGRAM EXECUTE without waiting for the
+ * operation to complete, so that another die can be used in the meantime.
+ * spinand_write_page_finish() must be called before the die is used again.
+ *
+ * Return: 0 on success, a negative error code otherwise.
+ */
+int spinand_write_page_start(struct spinand_device *spinand,
+			     const struct nand_page_io_req *req,
+			     bool ecc_enabled)
+{
+	struct spinand_op_batch batch;
+	int ret;
 
-	while (nbytes) {
-		ret = spi_mem_dirmap_write(wdesc, column, nbytes, buf);
-		if (ret < 0)
-			return ret;
+	ret = spinand_seq_read_end(spinand);
+	if (ret)
+		return ret;
 
-		if (!ret || ret > nbytes)
-			return -EIO;
+	ret = spinand_select_target(spinand, req->pos.target);
+	if (ret)
+		return ret;
 
-		nbytes -= ret;
-		column += ret;
-		buf += ret;
-	}
+	spinand_batch_begin(spinand, &batch);
+	ret = spinand_queue_program(spinand, req, ecc_enabled);
 
-	return 0;
+	return spinand_batch_end(spinand, ret);
 }
 
-static int spinand_program_op(struct spinand_device *spinand,
+/**
+ * spinand_write_page_finish() - Wait for a page program to complete
+ * @spinand: the spinand device
+ * @req: the I/O request passed to spinand_write_page_start()
+ *
+ * Return: 0 on success, -EREMOTEIO if the chip reported a program failure
+ *	   or another negative error code.
+ */
+int spinand_write_page_finish(struct spinand_device *spinand,
 			      const struct nand_page_io_req *req)
 {
-	struct nand_device *nand = spinand_to_nand(spinand);
-	unsigned int row = nanddev_pos_to_row(nand, &req->pos);
-	struct spi_mem_op op = SPINAND_PROG_EXEC_OP(row);
+	u8 status;
+	int ret;
 
-	return spi_mem_exec_op(spinand->spimem, &op);
-}
+	ret = spinand_select_target(spinand, req->pos.target);
+	if (ret)
+		return ret;
 
-static int spinand_erase_op(struct spinand_device *spinand,
-			    const struct nand_pos *pos)
-{
-	struct nand_device *nand = spinand_to_nand(spinand);
-	unsigned int row = nanddev_pos_to_row(nand, pos);
-	struct spi_mem_op op = SPINAND_BLK_ERASE_OP(row);
+	ret = spinand_wait(spinand, &status);
+	if (!ret && (status & STATUS_PROG_FAILED))
+		ret = -EREMOTEIO;
 
-	return spi_mem_exec_op(spinand->spimem, &op);
+	return ret;
 }
 
-static int spinand_wait(struct spinand_device *spinand, u8 *s)
+int spinand_write_page(struct spinand_device *spinand,
+		       const struct nand_page_io_req *req, bool ecc_enabled)
 {
-	time_t ctime, otime;
+	struct spinand_op_batch batch;
 	u8 status;
 	int ret;
-	time(&otime);
-	do {
-		ret = spinand_read_status(spinand, &status);
-		if (ret)
-			return ret;
 
-		if (!(status & STATUS_BUSY))
-			goto out;
-
-		time(&ctime);
-	} while (ctime - otime < 3);
+	ret = spinand_seq_read_end(spinand);
+	if (ret)
+		return ret;
 
-	/*
-	 * Extra read, just in case the STATUS_READY bit has changed
-	 * since our last check
-	 */
-	ret = spinand_read_status(spinand, &status);
+	ret = spinand_select_target(spinand, req->pos.target);
 	if (ret)
 		return ret;
 
-out:
-	if (s)
-		*s = status;
+	spinand_batch_begin(spinand, &batch);
+	ret = spinand_queue_program(spinand, req, ecc_enabled);
+	if (ret)
+		return spinand_batch_end(spinand, ret);
 
-	return status & STATUS_BUSY ? -ETIMEDOUT : 0;
+	ret = spinand_batch_end_wait(spinand, NULL, 0, &status);
+	if (!ret && (status & STATUS_PROG_FAILED))
+		ret = -EREMOTEIO;
+
+	return ret;
 }
 
-static int spinand_read_id_op(struct spinand_device *spinand, u8 naddr,
-			      u8 ndummy, u8 *buf)
+/**
+ * spinand_write_pages() - Program consecutive pages
+ * @spinand: the spinand device
+ * @pos: position of the first page
+ * @npages: number of pages to program. They may span several eraseblocks
+ *	    and dies
+ * @buf: source buffer. Each page takes the page size, plus the OOB size if
+ *	 @write_oob is set
+ * @write_oob: whether the OOB area of each page is programmed as well
+ * @ecc_enabled: whether on-die ECC should be enabled
+ *
+ * Stops at the first page which failed, the following ones are left
+ * untouched.
+ *
+ * Return: 0 on success, -EREMOTEIO if the chip reported a program failure
+ *	   or another negative error code.
+ */
+int spinand_write_pages(struct spinand_device *spinand,
+			const struct nand_pos *pos, unsigned int npages,
+			const void *buf, bool write_oob, bool ecc_enabled)
 {
-	struct spi_mem_op op = SPINAND_READID_OP(
-		naddr, ndummy, spinand->scratchbuf, SPINAND_MAX_ID_LEN);
+	struct nand_device *nand = spinand_to_nand(spinand);
+	size_t page_size = nanddev_page_size(nand);
+	size_t stride = page_size;
+	struct nand_page_io_req req = { .pos = *pos };
+	unsigned int i;
 	int ret;
 
-	ret = spi_mem_exec_op(spinand->spimem, &op);
-	if (!ret)
-		memcpy(buf, spinand->scratchbuf, SPINAND_MAX_ID_LEN);
+	req.datalen = page_size;
+	if (write_oob) {
+		req.ooblen = nanddev_per_page_oobsize(nand);
+		stride += req.ooblen;
+	}
 
-	return ret;
+	for (i = 0; i < npages; i++) {
+		req.databuf.out = buf + i * stride;
+		req.oobbuf.out = buf + i * stride + page_size;
+		ret = spinand_write_page(spinand, &req, ecc_enabled);
+		if (ret)
+			return ret;
+
+		nanddev_pos_next_page(nand, &req.pos);
+	}
+
+	return 0;
 }
 
-static int spinand_reset_op(struct spinand_device *spinand)
+/**
+ * spinand_erase_start() - Start erasing an eraseblock
+ * @spinand: the spinand device
+ * @pos: position of the eraseblock
+ *
+ * Issues BLOCK ERASE without waiting for the operation to complete.
+ * spinand_erase_finish() must be called before the die is used again.
+ *
+ * Return: 0 on success, a negative error code otherwise.
+ */
+int spinand_erase_start(struct spinand_device *spinand,
+			const struct nand_pos *pos)
 {
-	struct spi_mem_op op = SPINAND_RESET_OP;
+	struct spinand_op_batch batch;
 	int ret;
 
-	ret = spi_mem_exec_op(spinand->spimem, &op);
+	ret = spinand_seq_read_end(spinand);
 	if (ret)
 		return ret;
 
-	return spinand_wait(spinand, NULL);
-}
+	ret = spinand_select_target(spinand, pos->target);
+	if (ret)
+		return ret;
 
-static int spinand_lock_block(struct spinand_device *spinand, u8 lock)
-{
-	return spinand_write_reg_op(spinand, REG_BLOCK_LOCK, lock);
+	spinand_batch_begin(spinand, &batch);
+	ret = spinand_write_enable_op(spinand);
+	if (!ret)
+		ret = spinand_erase_op(spinand, pos);
+
+	return spinand_batch_end(spinand, ret);
 }
 
-static int spinand_check_ecc_status(struct spinand_device *spinand, u8 status)
+/**
+ * spinand_erase_finish() - Wait for an erase to complete
+ * @spinand: the spinand device
+ * @pos: position passed to spinand_erase_start()
+ *
+ * Return: 0 on success, -EIO if erasing failed or another negative error
+ *	   code.
+ */
+int spinand_erase_finish(struct spinand_device *spinand,
+			 const struct nand_pos *pos)
 {
-	struct nand_device *nand = spinand_to_nand(spinand);
-
-	if (spinand->eccinfo.get_status)
-		return spinand->eccinfo.get_status(spinand, status);
-
-	switch (status & STATUS_ECC_MASK) {
-	case STATUS_ECC_NO_BITFLIPS:
-		return 0;
-
-	case STATUS_ECC_HAS_BITFLIPS:
-		/*
-		 * We have no way to know exactly how many bitflips have been
-		 * fixed, so let's return the maximum possible value so that
-		 * wear-leveling layers move the data immediately.
-		 */
-		return nand->eccreq.strength;
+	u8 status;
+	int ret;
 
-	case STATUS_ECC_UNCOR_ERROR:
-		return -EBADMSG;
+	ret = spinand_select_target(spinand, pos->target);
+	if (ret)
+		return ret;
 
-	default:
-		break;
-	}
+	ret = spinand_wait(spinand, &status);
+	if (!ret && (status & STATUS_ERASE_FAILED))
+		ret = -EIO;
 
-	return -EINVAL;
+	return ret;
 }
 
-int spinand_read_page(struct spinand_device *spinand,
-			     const struct nand_page_io_req *req,
-			     bool ecc_enabled)
+int spinand_erase(struct spinand_device *spinand, const struct nand_pos *pos)
 {
+	struct spinand_op_batch batch;
 	u8 status;
 	int ret;
 
-	ret = spinand_select_target(spinand, req->pos.target);
+	ret = spinand_seq_read_end(spinand);
 	if (ret)
 		return ret;
 
-	ret = spinand_ecc_enable(spinand, ecc_enabled);
+	ret = spinand_select_target(spinand, pos->target);
 	if (ret)
 		return ret;
 
-	ret = spinand_load_page_op(spinand, req);
+	spinand_batch_begin(spinand, &batch);
+	ret = spinand_write_enable_op(spinand);
+	if (!ret)
+		ret = spinand_erase_op(spinand, pos);
 	if (ret)
-		return ret;
+		return spinand_batch_end(spinand, ret);
 
-	ret = spinand_wait(spinand, &status);
-	if (ret < 0)
-		return ret;
+	ret = spinand_batch_end_wait(spinand, NULL, 0, &status);
+	if (!ret && (status & STATUS_ERASE_FAILED))
+		ret = -EIO;
 
-	ret = spinand_read_from_cache_op(spinand, req);
-	if (ret)
-		return ret;
+	return ret;
+}
 
-	if (!ecc_enabled)
-		return 0;
+static int spinand_patch_cache(struct spinand_device *spinand,
+			       const struct nand_page_io_req *req)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	int ret;
+
+	if (req->datalen) {
+		ret = spinand_load_cache(spinand, req, req->dataoffs,
+					 req->datalen, req->databuf.out,
+					 false);
+		if (ret)
+			return ret;
+	}
+
+	if (req->ooblen) {
+		ret = spinand_load_cache(spinand, req,
+					 nanddev_page_size(nand) +
+					 req->ooboffs, req->ooblen,
+					 req->oobbuf.out, false);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
 
-	return spinand_check_ecc_status(spinand, status);
+/**
+ * spinand_copy_possible() - Check if a page can be moved internally
+ * @spinand: the spinand device
+ * @src: source position
+ * @dst: destination position
+ *
+ * The cache register is per-plane and only reachable from the die that owns
+ * it, so internal data move only works within the same target, LUN and
+ * plane.
+ *
+ * Return: true if spinand_copy_page() can move data from @src to @dst.
+ */
+bool spinand_copy_possible(struct spinand_device *spinand,
+			   const struct nand_pos *src,
+			   const struct nand_pos *dst)
+{
+	return src->target == dst->target && src->lun == dst->lun &&
+	       src->plane == dst->plane;
 }
 
-int spinand_write_page(struct spinand_device *spinand,
-		       const struct nand_page_io_req *req, bool ecc_enabled)
+/**
+ * spinand_copy_page() - Copy a page without moving the data over the bus
+ * @spinand: the spinand device
+ * @src: position of the page to copy
+ * @req: the destination page is at @req->pos. Data and OOB ranges of @req,
+ *	 if any, replace the matching bytes of the source page
+ * @ecc_enabled: whether on-die ECC should be enabled
+ *
+ * Loads the source page into the cache register with PAGE READ, patches it
+ * with RANDOM DATA PROGRAM LOAD if requested and programs it to the
+ * destination row. With on-die ECC enabled the data is corrected on the way
+ * and the ECC bytes are regenerated for the new page.
+ *
+ * Return: the number of corrected bitflips in the source page, -EINVAL if
+ *	   the pages aren't in the same plane of the same die, -EBADMSG if the
+ *	   source page is uncorrectable (nothing is programmed then),
+ *	   -EREMOTEIO if the chip reported a program failure or another
+ *	   negative error code.
+ */
+int spinand_copy_page(struct spinand_device *spinand,
+		      const struct nand_pos *src,
+		      const struct nand_page_io_req *req, bool ecc_enabled)
 {
+	struct nand_page_io_req src_req = { .pos = *src };
+	int ret, bitflips = 0;
 	u8 status;
-	int ret;
 
-	ret = spinand_select_target(spinand, req->pos.target);
-	if (ret)
-		return ret;
+	if (!spinand_copy_possible(spinand, src, &req->pos))
+		return -EINVAL;
 
-	ret = spinand_ecc_enable(spinand, ecc_enabled);
+	ret = spinand_seq_read_end(spinand);
 	if (ret)
 		return ret;
 
-	ret = spinand_write_enable_op(spinand);
+	ret = spinand_select_target(spinand, src->target);
 	if (ret)
 		return ret;
 
-	ret = spinand_write_to_cache_op(spinand, req);
+	ret = spinand_ecc_enable(spinand, ecc_enabled);
 	if (ret)
 		return ret;
 
-	ret = spinand_program_op(spinand, req);
+	ret = spinand_load_page_op(spinand, &src_req);
 	if (ret)
 		return ret;
 
 	ret = spinand_wait(spinand, &status);
-	if (!ret && (status & STATUS_PROG_FAILED))
-		ret = -EIO;
-
-	return ret;
-}
+	if (ret)
+		return ret;
 
-int spinand_erase(struct spinand_device *spinand, const struct nand_pos *pos)
-{
-	u8 status;
-	int ret;
+	if (ecc_enabled) {
+		bitflips = spinand_check_ecc_status(spinand, status);
+		if (bitflips < 0)
+			return bitflips;
+	}
 
-	ret = spinand_select_target(spinand, pos->target);
+	ret = spinand_write_enable_op(spinand);
 	if (ret)
 		return ret;
 
-	ret = spinand_write_enable_op(spinand);
+	ret = spinand_patch_cache(spinand, req);
 	if (ret)
 		return ret;
 
-	ret = spinand_erase_op(spinand, pos);
+	ret = spinand_program_op(spinand, req);
 	if (ret)
 		return ret;
 
 	ret = spinand_wait(spinand, &status);
-	if (!ret && (status & STATUS_ERASE_FAILED))
-		ret = -EIO;
+	if (ret)
+		return ret;
 
-	return ret;
+	if (status & STATUS_PROG_FAILED)
+		return -EREMOTEIO;
+
+	return bitflips;
+}
+
+/**
+ * spinand_copy_block() - Copy a whole eraseblock inside the chip
+ * @spinand: the spinand device
+ * @src: position of the source eraseblock
+ * @dst: position of the destination eraseblock, which must be erased
+ * @ecc_enabled: whether on-die ECC should be enabled
+ *
+ * Copies all pages of @src to @dst with spinand_copy_page(), in order.
+ *
+ * Return: the maximum number of corrected bitflips, or the first error
+ *	   returned by spinand_copy_page().
+ */
+int spinand_copy_block(struct spinand_device *spinand,
+		       const struct nand_pos *src, const struct nand_pos *dst,
+		       bool ecc_enabled)
+{
+	struct nand_device *nand = spinand_to_nand(spinand);
+	unsigned int ppb = nanddev_pages_per_eraseblock(nand);
+	struct nand_page_io_req req = { .pos = *dst };
+	struct nand_pos pos = *src;
+	int ret, max_bitflips = 0;
+
+	for (pos.page = 0; pos.page < ppb; pos.page++) {
+		req.pos.page = pos.page;
+		ret = spinand_copy_page(spinand, &pos, &req, ecc_enabled);
+		if (ret < 0)
+			return ret;
+
+		if (ret > max_bitflips)
+			max_bitflips = ret;
+	}
+
+	return max_bitflips;
 }
 
 static int spinand_create_dirmap(struct spinand_device *spinand,
@@ -520,6 +2086,15 @@ static int spinand_create_dirmap(struct spinand_device *spinand,
 
 	spinand->dirmaps[plane].wdesc = desc;
 
+	if (spinand->flags & SPINAND_HAS_PROG_LOAD_RESET) {
+		info.op_tmpl = *spinand->op_templates.write_cache;
+		desc = spi_mem_dirmap_create(spinand->spimem, &info);
+		if (IS_ERR(desc))
+			return PTR_ERR(desc);
+
+		spinand->dirmaps[plane].wdesc_reset = desc;
+	}
+
 	info.op_tmpl = *spinand->op_templates.read_cache;
 	desc = spi_mem_dirmap_create(spinand->spimem, &info);
 	if (IS_ERR(desc))
@@ -703,6 +2278,8 @@ int spinand_match_and_init(struct spinand_device *spinand,
 		spinand->flags = table[i].flags;
 		spinand->id.len = 1 + table[i].devid.len;
 		spinand->select_target = table[i].select_target;
+		spinand->set_cont_read = table[i].set_cont_read;
+		spinand_init_busy(spinand, &table[i].timings);
 
 		op = spinand_select_op_variant(spinand,
 					       info->op_variants.read_cache);
@@ -770,21 +2347,33 @@ static int spinand_init(struct spinand_device *spinand)
 	 * We need a scratch buffer because the spi_mem interface requires that
 	 * buf passed in spi_mem_op->data.buf be DMA-able.
 	 */
-	spinand->scratchbuf = calloc(SPINAND_MAX_ID_LEN, 1);
+	spinand->scratchbuf = spi_mem_alloc_buf(spinand->spimem,
+						SPINAND_STATUS_BURST_MAX);
 	if (!spinand->scratchbuf)
 		return -ENOMEM;
+	memset(spinand->scratchbuf, 0, SPINAND_STATUS_BURST_MAX);
+
+	spinand_init_busy(spinand, &spinand_default_timings);
 
 	ret = spinand_detect(spinand);
 	if (ret)
 		goto err_free_bufs;
 
+	spinand->busy_state = calloc(nand->memorg.ntargets,
+				     sizeof(*spinand->busy_state));
+	if (!spinand->busy_state) {
+		ret = -ENOMEM;
+		goto err_free_bufs;
+	}
+
 	/*
 	 * Use kzalloc() instead of devm_kzalloc() here, because some drivers
 	 * may use this buffer for DMA access.
 	 * Memory allocated by devm_ does not guarantee DMA-safe alignment.
 	 */
-	spinand->databuf = malloc(nanddev_page_size(nand) +
-			       nanddev_per_page_oobsize(nand));
+	spinand->databuf = spi_mem_alloc_buf(spinand->spimem,
+					     nanddev_page_size(nand) +
+					     nanddev_per_page_oobsize(nand));
 	if (!spinand->databuf) {
 		ret = -ENOMEM;
 		goto err_free_bufs;
@@ -840,16 +2429,45 @@ err_manuf_cleanup:
 	spinand_manufacturer_cleanup(spinand);
 
 err_free_bufs:
-	free(spinand->databuf);
-	free(spinand->scratchbuf);
+	free(spinand->busy_state);
+	spi_mem_free_buf(spinand->spimem, spinand->databuf);
+	spi_mem_free_buf(spinand->spimem, spinand->scratchbuf);
 	return ret;
 }
 
 static void spinand_cleanup(struct spinand_device *spinand)
 {
 	spinand_manufacturer_cleanup(spinand);
-	free(spinand->databuf);
-	free(spinand->scratchbuf);
+	free(spinand->busy_state);
+	spi_mem_free_buf(spinand->spimem, spinand->databuf);
+	spi_mem_free_buf(spinand->spimem, spinand->scratchbuf);
+}
+
+/**
+ * spinand_alloc_buf() - Allocate a buffer for page data
+ * @spinand: SPI NAND device
+ * @len: size of the buffer
+ *
+ * Page and OOB buffers passed to the read and write functions should come
+ * from here: they are taken from the controller, which may be able to
+ * transfer them without copying the data around.
+ *
+ * Return: the buffer, or NULL on failure. It must be released with
+ *	   spinand_free_buf() before the device is removed.
+ */
+void *spinand_alloc_buf(struct spinand_device *spinand, size_t len)
+{
+	return spi_mem_alloc_buf(spinand->spimem, len);
+}
+
+/**
+ * spinand_free_buf() - Release a buffer allocated by spinand_alloc_buf()
+ * @spinand: SPI NAND device
+ * @buf: the buffer, may be NULL
+ */
+void spinand_free_buf(struct spinand_device *spinand, void *buf)
+{
+	spi_mem_free_buf(spinand->spimem, buf);
 }
 
 struct spinand_device _spinand;
@@ -82,6 +82,12 @@ static int micron_8_ecc_get_status(struct spinand_device *spinand,
 	return -EINVAL;
 }
 
+static int micron_set_cont_read(struct spinand_device *spinand, bool enable)
+{
+	return spinand_upd_cfg(spinand, MICRON_CFG_CR,
+			       enable ? MICRON_CFG_CR : 0);
+}
+
 static const struct spinand_info micron_spinand_table[] = {
 	/* M79A 2Gb 3.3V */
 	SPINAND_INFO("MT29F2G01ABAGD",
@@ -91,8 +97,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
-		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
+		     SPINAND_HAS_READ_CACHE_SEQ | SPINAND_HAS_PROG_LOAD_RESET |
+		     SPINAND_HAS_CONT_STATUS,
+		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_TIMINGS(50, 115, 200, 600, 2000, 10000)),
 	/* M79A 2Gb 1.8V */
 	SPINAND_INFO("MT29F2G01ABBGD",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0x25),
@@ -101,8 +109,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
-		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
+		     SPINAND_HAS_READ_CACHE_SEQ | SPINAND_HAS_PROG_LOAD_RESET |
+		     SPINAND_HAS_CONT_STATUS,
+		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_TIMINGS(50, 115, 200, 600, 2000, 10000)),
 	/* M78A 1Gb 3.3V */
 	SPINAND_INFO("MT29F1G01ABAFD",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0x14),
@@ -111,7 +121,8 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
+		     SPINAND_HAS_READ_CACHE_SEQ | SPINAND_HAS_PROG_LOAD_RESET |
+		     SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
 	/* M78A 1Gb 1.8V */
 	SPINAND_INFO("MT29F1G01ABAFD",
@@ -121,7 +132,8 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
+		     SPINAND_HAS_READ_CACHE_SEQ | SPINAND_HAS_PROG_LOAD_RESET |
+		     SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
 	/* M79A 4Gb 3.3V */
 	SPINAND_INFO("MT29F4G01ADAGD",
@@ -131,8 +143,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
+		     SPINAND_HAS_READ_CACHE_SEQ | SPINAND_HAS_PROG_LOAD_RESET |
+		     SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_TIMINGS(50, 115, 200, 600, 2000, 10000),
 		     SPINAND_SELECT_TARGET(micron_select_target)),
 	/* M70A 4Gb 3.3V */
 	SPINAND_INFO("MT29F4G01ABAFD",
@@ -142,8 +156,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     SPINAND_HAS_CR_FEAT_BIT,
-		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
+		     SPINAND_HAS_CR_FEAT_BIT | SPINAND_HAS_READ_CACHE_SEQ |
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
+		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_CONT_READ(micron_set_cont_read)),
 	/* M70A 4Gb 1.8V */
 	SPINAND_INFO("MT29F4G01ABBFD",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0x35),
@@ -152,8 +168,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     SPINAND_HAS_CR_FEAT_BIT,
-		     SPINAND_ECCINFO(micron_8_ecc_get_status)),
+		     SPINAND_HAS_CR_FEAT_BIT | SPINAND_HAS_READ_CACHE_SEQ |
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
+		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_CONT_READ(micron_set_cont_read)),
 	/* M70A 8Gb 3.3V */
 	SPINAND_INFO("MT29F8G01ADAFD",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0x46),
@@ -162,8 +180,10 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     SPINAND_HAS_CR_FEAT_BIT,
+		     SPINAND_HAS_CR_FEAT_BIT | SPINAND_HAS_READ_CACHE_SEQ |
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_CONT_READ(micron_set_cont_read)
 		     SPINAND_SELECT_TARGET(micron_select_target)),
 	/* M70A 8Gb 1.8V */
 	SPINAND_INFO("MT29F8G01ADBFD",
@@ -173,17 +193,19 @@ static const struct spinand_info micron_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     SPINAND_HAS_CR_FEAT_BIT,
+		     SPINAND_HAS_CR_FEAT_BIT | SPINAND_HAS_READ_CACHE_SEQ |
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(micron_8_ecc_get_status),
+		     SPINAND_CONT_READ(micron_set_cont_read)
 		     SPINAND_SELECT_TARGET(micron_select_target)),
 };
 
 static int micron_spinand_init(struct spinand_device *spinand)
 {
 	/*
-	 * M70A device series enable Continuous Read feature at Power-up,
-	 * which is not supported. Disable this bit to avoid any possible
-	 * failure.
+	 * M70A device series enable Continuous Read feature at Power-up.
+	 * Disable this bit so that regular page reads work, it is only
+	 * switched on by spinand_read_cont().
 	 */
 	if (spinand->flags & SPINAND_HAS_CR_FEAT_BIT)
 		return spinand_upd_cfg(spinand, MICRON_CFG_CR, 0);
@@ -43,6 +43,12 @@ static int w25m02gv_select_target(struct spinand_device *spinand,
 	return spi_mem_exec_op(spinand->spimem, &op);
 }
 
+static int winbond_set_cont_read(struct spinand_device *spinand, bool enable)
+{
+	return spinand_upd_cfg(spinand, WINBOND_CFG_BUF_READ,
+			       enable ? 0 : WINBOND_CFG_BUF_READ);
+}
+
 static const struct spinand_info winbond_spinand_table[] = {
 	SPINAND_INFO("W25M02GV",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0xab),
@@ -51,8 +57,10 @@ static const struct spinand_info winbond_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
 		     SPINAND_ECCINFO(NULL),
+		     SPINAND_TIMINGS(25, 60, 250, 700, 2000, 10000),
+		     SPINAND_CONT_READ(winbond_set_cont_read)
 		     SPINAND_SELECT_TARGET(w25m02gv_select_target)),
 	SPINAND_INFO("W25N01GV",
 		     SPINAND_ID(SPINAND_READID_METHOD_OPCODE_DUMMY, 0xaa),
@@ -61,8 +69,10 @@ static const struct spinand_info winbond_spinand_table[] = {
 		     SPINAND_INFO_OP_VARIANTS(&read_cache_variants,
 					      &write_cache_variants,
 					      &update_cache_variants),
-		     0,
-		     SPINAND_ECCINFO(NULL)),
+		     SPINAND_HAS_PROG_LOAD_RESET | SPINAND_HAS_CONT_STATUS,
+		     SPINAND_ECCINFO(NULL),
+		     SPINAND_TIMINGS(25, 60, 250, 700, 2000, 10000),
+		     SPINAND_CONT_READ(winbond_set_cont_read)),
 };
 
 static int winbond_spinand_init(struct spinand_device *spinand)
@@ -72,7 +82,7 @@ static int winbond_spinand_init(struct spinand_device *spinand)
 
 	/*
 	 * Make sure all dies are in buffer read mode and not continuous read
-	 * mode.
+	 * mode. The latter is only switched on by spinand_read_cont().
 	 */
 	for (i = 0; i < nand->memorg.ntargets; i++) {
 		spinand_select_target(spinand, i);
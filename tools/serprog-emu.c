@@ -0,0 +1,1032 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * serprog programmer emulator with a simulated SPI-NAND attached.
+ *
+ * This creates a pseudo terminal which talks the serprog protocol, so that
+ * spi-nand-prog can be run against it with "-d serprog -a <pty>" without
+ * any hardware. Array busy times are simulated in real time and accesses
+ * which would be illegal on a real chip (e.g. talking to a busy die) are
+ * counted and reported on SIGUSR1 and at exit. The serprog extensions of
+ * include/serprog.h are advertised with -X.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <serprog.h>
+#include <crc32.h>
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define ST_BUSY		(1 << 0)
+#define ST_WEL		(1 << 1)
+#define ST_E_FAIL	(1 << 2)
+#define ST_P_FAIL	(1 << 3)
+
+#define CFG_ECC_EN	(1 << 4)
+#define WB_CFG_BUF	(1 << 3)
+#define MT_CFG_CR	(1 << 0)
+
+#define T_RCBSY_US	3
+#define T_RST_US	5
+
+enum die_sel {
+	DIE_SEL_NONE,
+	DIE_SEL_WINBOND,
+	DIE_SEL_MICRON,
+};
+
+enum cont_read {
+	CONT_READ_NONE,
+	CONT_READ_WINBOND,
+	CONT_READ_MICRON,
+};
+
+struct emu_model {
+	const char *name;
+	u8 id[3];
+	unsigned int pagesize;
+	unsigned int oobsize;
+	unsigned int pages_per_block;
+	unsigned int blocks_per_die;
+	unsigned int ndies;
+	unsigned int planes;
+	enum die_sel die_sel;
+	enum cont_read cont_read;
+	bool cache_read;
+	u8 cfg_default;
+};
+
+static const struct emu_model models[] = {
+	{ "W25N01GV", { 0xef, 0xaa, 0x21 }, 2048, 64, 64, 1024, 1, 1,
+	  DIE_SEL_NONE, CONT_READ_WINBOND, false, CFG_ECC_EN | WB_CFG_BUF },
+	{ "W25M02GV", { 0xef, 0xab, 0x21 }, 2048, 64, 64, 1024, 2, 1,
+	  DIE_SEL_WINBOND, CONT_READ_WINBOND, false, CFG_ECC_EN | WB_CFG_BUF },
+	{ "MT29F1G01ABAFD", { 0x2c, 0x14 }, 2048, 128, 64, 1024, 1, 1,
+	  DIE_SEL_NONE, CONT_READ_NONE, true, CFG_ECC_EN },
+	{ "MT29F2G01ABAGD", { 0x2c, 0x24 }, 2048, 128, 64, 2048, 1, 2,
+	  DIE_SEL_NONE, CONT_READ_NONE, true, CFG_ECC_EN },
+	{ "MT29F4G01ADAGD", { 0x2c, 0x36 }, 2048, 128, 64, 2048, 2, 2,
+	  DIE_SEL_MICRON, CONT_READ_NONE, true, CFG_ECC_EN },
+	{ "MT29F4G01ABAFD", { 0x2c, 0x34 }, 4096, 256, 64, 2048, 1, 1,
+	  DIE_SEL_NONE, CONT_READ_MICRON, true, CFG_ECC_EN | MT_CFG_CR },
+};
+
+struct emu_die {
+	u8 *cache;
+	u8 status;
+	u8 cfg;
+	u8 lock;
+	u64 busy_until;
+	/* data register used by cache reads */
+	int dreg_row;
+	u64 dreg_ready;
+	int cache_row;
+	bool seq_active;
+	/* continuous read stream position */
+	int cont_row;
+};
+
+struct emu_stats {
+	u64 cmds;
+	u64 spiops;
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 page_reads;
+	u64 cache_reads;
+	u64 programs;
+	u64 erases;
+	u64 busy_violations;
+	u64 plane_violations;
+	u64 reprograms;
+	u64 ext_cmds;
+};
+
+static const struct emu_model *model;
+static struct emu_die dies[4];
+static unsigned int cur_die;
+static u8 **blocks;
+static unsigned int spi_freq = 24000000;
+static unsigned int serbuf_size = 4096;
+static unsigned int t_r_us = 25, t_prog_us = 250, t_bers_us = 2000;
+static unsigned int t_scale = 1;
+static struct emu_stats stats;
+static int fail_block = -1;
+static volatile sig_atomic_t dump_stats;
+static int verbose;
+static int extensions;
+
+static u64 now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static unsigned int page_total(void)
+{
+	return model->pagesize + model->oobsize;
+}
+
+static unsigned int row_bits(void)
+{
+	return __builtin_ctz(model->pages_per_block);
+}
+
+static unsigned int row_block(unsigned int row)
+{
+	return row >> row_bits();
+}
+
+static unsigned int row_page(unsigned int row)
+{
+	return row & (model->pages_per_block - 1);
+}
+
+static u8 *page_ptr(unsigned int die, unsigned int row, bool alloc)
+{
+	unsigned int blk = die * model->blocks_per_die + row_block(row);
+	size_t bsize = (size_t)page_total() * model->pages_per_block;
+
+	if (row_block(row) >= model->blocks_per_die)
+		return NULL;
+
+	if (!blocks[blk]) {
+		if (!alloc)
+			return NULL;
+		blocks[blk] = malloc(bsize);
+		if (!blocks[blk]) {
+			perror("malloc");
+			exit(1);
+		}
+		memset(blocks[blk], 0xff, bsize);
+	}
+
+	return blocks[blk] + (size_t)row_page(row) * page_total();
+}
+
+static void load_page(unsigned int die, unsigned int row, u8 *dst)
+{
+	u8 *p = page_ptr(die, row, false);
+
+	if (p)
+		memcpy(dst, p, page_total());
+	else
+		memset(dst, 0xff, page_total());
+}
+
+static void program_row(unsigned int row, const u8 *src)
+{
+	unsigned int i;
+	u8 *p = page_ptr(cur_die, row, true);
+
+	if (!p)
+		return;
+	for (i = 0; i < page_total(); i++) {
+		if (p[i] != 0xff && src[i] != 0xff)
+			break;
+	}
+	if (i != page_total())
+		stats.reprograms++;
+	for (i = 0; i < page_total(); i++)
+		p[i] &= src[i];
+}
+
+static struct emu_die *die(void)
+{
+	return &dies[cur_die];
+}
+
+static bool die_busy(struct emu_die *d, u64 t)
+{
+	return t < d->busy_until;
+}
+
+static void violation(const char *what, u8 opcode)
+{
+	stats.busy_violations++;
+	if (verbose || stats.busy_violations < 10)
+		fprintf(stderr, "emu: %s (opcode 0x%02x, die %u)\n", what,
+			opcode, cur_die);
+}
+
+static void check_plane(struct emu_die *d, unsigned int column)
+{
+	unsigned int plane;
+
+	if (model->planes < 2 || d->cache_row < 0)
+		return;
+
+	plane = (column >> (__builtin_ctz(model->pagesize) + 1)) & 1;
+	if (plane != (row_block(d->cache_row) & 1)) {
+		stats.plane_violations++;
+		if (verbose || stats.plane_violations < 10)
+			fprintf(stderr,
+				"emu: plane bit %u does not match row 0x%x\n",
+				plane, d->cache_row);
+	}
+}
+
+static unsigned int cache_column(unsigned int column)
+{
+	return column & ((model->pagesize << 1) - 1);
+}
+
+static bool cont_read_enabled(struct emu_die *d)
+{
+	if (model->cont_read == CONT_READ_WINBOND)
+		return !(d->cfg & WB_CFG_BUF);
+	if (model->cont_read == CONT_READ_MICRON)
+		return d->cfg & MT_CFG_CR;
+	return false;
+}
+
+static u8 reg_read(struct emu_die *d, u8 reg, u64 t)
+{
+	switch (reg) {
+	case 0xa0:
+		return d->lock;
+	case 0xb0:
+		return d->cfg;
+	case 0xc0:
+		return d->status | (die_busy(d, t) ? ST_BUSY : 0);
+	case 0xd0:
+		return cur_die << 6;
+	default:
+		return 0;
+	}
+}
+
+static void reg_write(struct emu_die *d, u8 reg, u8 val)
+{
+	switch (reg) {
+	case 0xa0:
+		d->lock = val;
+		break;
+	case 0xb0:
+		d->cfg = val;
+		break;
+	case 0xd0:
+		if (model->die_sel == DIE_SEL_MICRON)
+			cur_die = (val >> 6) & (model->ndies - 1);
+		break;
+	default:
+		break;
+	}
+}
+
+static unsigned int be_addr(const u8 *p, int n)
+{
+	unsigned int v = 0;
+
+	while (n--)
+		v = (v << 8) | *p++;
+	return v;
+}
+
+/* Time at which byte @idx of the current transaction is clocked. */
+static u64 byte_time(u64 t0, size_t idx)
+{
+	return t0 + (u64)idx * 8 * 1000000 / spi_freq;
+}
+
+static void nand_cont_read(struct emu_die *d, u8 *rx, size_t rlen)
+{
+	size_t i;
+
+	for (i = 0; i < rlen; i++) {
+		unsigned int col = i % model->pagesize;
+
+		if (i && !col) {
+			d->cont_row++;
+			load_page(cur_die, d->cont_row, d->cache);
+			stats.page_reads++;
+		}
+		rx[i] = d->cache[col];
+	}
+	d->cont_row++;
+	load_page(cur_die, d->cont_row, d->cache);
+}
+
+static void nand_txn(const u8 *tx, size_t slen, u8 *rx, size_t rlen)
+{
+	struct emu_die *d = die();
+	u64 t = now_us();
+	u8 opc;
+	unsigned int row, col;
+	size_t i;
+
+	memset(rx, 0xff, rlen);
+	if (!slen)
+		return;
+
+	opc = tx[0];
+	if (die_busy(d, t) && opc != 0x0f && opc != 0xc2 && opc != 0xff &&
+	    !(opc == 0x1f && slen > 1 && tx[1] == 0xd0))
+		violation("command issued while die busy", opc);
+
+	switch (opc) {
+	case 0xff:
+		d->status = 0;
+		d->seq_active = false;
+		d->busy_until = t + T_RST_US;
+		break;
+	case 0x06:
+		d->status |= ST_WEL;
+		break;
+	case 0x04:
+		d->status &= ~ST_WEL;
+		break;
+	case 0x9f:
+		for (i = 0; i < rlen; i++) {
+			size_t idx = i + slen - 2;
+
+			if (slen >= 2 && idx < sizeof(model->id))
+				rx[i] = model->id[idx];
+			else
+				rx[i] = 0;
+		}
+		break;
+	case 0x0f:
+		if (slen < 2)
+			break;
+		for (i = 0; i < rlen; i++)
+			rx[i] = reg_read(d, tx[1], byte_time(t, slen + i));
+		break;
+	case 0x1f:
+		if (slen < 3)
+			break;
+		reg_write(d, tx[1], tx[2]);
+		break;
+	case 0xc2:
+		if (model->die_sel == DIE_SEL_WINBOND && slen >= 2)
+			cur_die = tx[1] & (model->ndies - 1);
+		break;
+	case 0x13:
+		if (slen < 4)
+			break;
+		row = be_addr(tx + 1, 3);
+		stats.page_reads++;
+		d->seq_active = false;
+		load_page(cur_die, row, d->cache);
+		d->cache_row = row;
+		d->dreg_row = row;
+		d->cont_row = row;
+		d->busy_until = t + t_r_us * t_scale;
+		d->dreg_ready = d->busy_until;
+		d->status &= ~0x30;
+		break;
+	case 0x31:
+	case 0x3f: {
+		u64 start;
+
+		if (!model->cache_read) {
+			violation("cache read not supported", opc);
+			break;
+		}
+		if (d->dreg_row < 0) {
+			violation("cache read without page read", opc);
+			break;
+		}
+		start = t > d->dreg_ready ? t : d->dreg_ready;
+		load_page(cur_die, d->dreg_row, d->cache);
+		d->cache_row = d->dreg_row;
+		d->busy_until = start + T_RCBSY_US;
+		if (opc == 0x31) {
+			d->dreg_row++;
+			d->dreg_ready = d->busy_until + t_r_us * t_scale;
+			d->seq_active = true;
+			stats.page_reads++;
+		} else {
+			d->dreg_ready = d->busy_until;
+			d->seq_active = false;
+		}
+		break;
+	}
+	case 0x03:
+	case 0x0b:
+		if (slen < 4)
+			break;
+		stats.cache_reads++;
+		if (cont_read_enabled(d)) {
+			nand_cont_read(d, rx, rlen);
+			break;
+		}
+		col = be_addr(tx + 1, 2);
+		check_plane(d, col);
+		col = cache_column(col);
+		for (i = 0; i < rlen && col + i < page_total(); i++)
+			rx[i] = d->cache[col + i];
+		break;
+	case 0x02:
+	case 0x84:
+		if (slen < 3)
+			break;
+		col = be_addr(tx + 1, 2);
+		if (opc == 0x02)
+			memset(d->cache, 0xff, page_total());
+		col = cache_column(col);
+		for (i = 3; i < slen && col + i - 3 < page_total(); i++)
+			d->cache[col + i - 3] = tx[i];
+		break;
+	case 0x10:
+		if (slen < 4)
+			break;
+		row = be_addr(tx + 1, 3);
+		stats.programs++;
+		d->status &= ~ST_P_FAIL;
+		if (!(d->status & ST_WEL) || d->lock ||
+		    (int)(cur_die * model->blocks_per_die + row_block(row)) ==
+			    fail_block) {
+			/* only the first program fails, so the BBM sticks */
+			fail_block = -1;
+			d->status |= ST_P_FAIL;
+		} else {
+			program_row(row, d->cache);
+		}
+		d->status &= ~ST_WEL;
+		d->busy_until = t + t_prog_us * t_scale;
+		break;
+	case 0xd8:
+		if (slen < 4)
+			break;
+		row = be_addr(tx + 1, 3);
+		stats.erases++;
+		d->status &= ~ST_E_FAIL;
+		if (!(d->status & ST_WEL) || d->lock) {
+			d->status |= ST_E_FAIL;
+		} else {
+			unsigned int blk = cur_die * model->blocks_per_die +
+					   row_block(row);
+
+			if (row_block(row) < model->blocks_per_die) {
+				free(blocks[blk]);
+				blocks[blk] = NULL;
+			}
+		}
+		d->status &= ~ST_WEL;
+		d->busy_until = t + t_bers_us * t_scale;
+		break;
+	default:
+		fprintf(stderr, "emu: unknown opcode 0x%02x\n", opc);
+		break;
+	}
+
+	/* Don't answer before the bus would have clocked every byte. */
+	while (now_us() < byte_time(t, slen + rlen))
+		;
+}
+
+/* serial side */
+
+static int fd;
+static u8 rxbuf[65536];
+static size_t rxhead, rxtail;
+
+static void ser_fill(void)
+{
+	ssize_t ret;
+
+	if (rxhead == rxtail)
+		rxhead = rxtail = 0;
+
+	do {
+		ret = read(fd, rxbuf + rxtail, sizeof(rxbuf) - rxtail);
+		if (ret < 0 && errno == EINTR && dump_stats)
+			return;
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		perror("emu: read");
+		exit(1);
+	}
+	rxtail += ret;
+	stats.bytes_in += ret;
+}
+
+static void ser_read(void *buf, size_t len)
+{
+	u8 *p = buf;
+
+	while (len) {
+		size_t n;
+
+		while (rxhead == rxtail)
+			ser_fill();
+		n = rxtail - rxhead;
+		if (n > len)
+			n = len;
+		memcpy(p, rxbuf + rxhead, n);
+		rxhead += n;
+		p += n;
+		len -= n;
+	}
+}
+
+static u8 txbuf[1 << 20];
+static size_t txlen;
+
+static void ser_flush(void)
+{
+	size_t done = 0;
+
+	while (done < txlen) {
+		ssize_t ret = write(fd, txbuf + done, txlen - done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			perror("emu: write");
+			exit(1);
+		}
+		done += ret;
+	}
+	stats.bytes_out += txlen;
+	txlen = 0;
+}
+
+static void ser_write(const void *buf, size_t len)
+{
+	const u8 *p = buf;
+
+	while (len) {
+		size_t n = sizeof(txbuf) - txlen;
+
+		if (n > len)
+			n = len;
+		memcpy(txbuf + txlen, p, n);
+		txlen += n;
+		p += n;
+		len -= n;
+		if (txlen == sizeof(txbuf))
+			ser_flush();
+	}
+}
+
+static void ser_put(u8 c)
+{
+	ser_write(&c, 1);
+}
+
+static u32 get_le(int n)
+{
+	u8 b[4] = {};
+	u32 v = 0;
+
+	ser_read(b, n);
+	while (n--)
+		v = (v << 8) | b[n];
+	return v;
+}
+
+static void put_le(u32 v, int n)
+{
+	while (n--) {
+		ser_put(v & 0xff);
+		v >>= 8;
+	}
+}
+
+static u8 cmdmap[32];
+
+static void cmdmap_set(u8 cmd)
+{
+	cmdmap[cmd / 8] |= 1 << (cmd % 8);
+}
+
+static u8 sbuf[1 << 24], rbuf[1 << 24];
+
+static void handle_spiop(void)
+{
+	u32 slen = get_le(3);
+	u32 rlen = get_le(3);
+
+	ser_read(sbuf, slen);
+	stats.spiops++;
+	nand_txn(sbuf, slen, rbuf, rlen);
+	ser_put(S_ACK);
+	ser_write(rbuf, rlen);
+}
+
+/* Poll parameters shared by the extensions. */
+struct poll_spec {
+	u8 sbuf[256];
+	u8 slen;
+	u8 mask;
+	u8 match;
+	u32 timeout_ms;
+};
+
+static void get_poll_spec(struct poll_spec *p)
+{
+	p->slen = get_le(1);
+	ser_read(p->sbuf, p->slen);
+	p->mask = get_le(1);
+	p->match = get_le(1);
+	p->timeout_ms = get_le(2);
+}
+
+static int poll_status(const struct poll_spec *p, u8 *st)
+{
+	u64 deadline = now_us() + (u64)p->timeout_ms * 1000;
+
+	for (;;) {
+		nand_txn(p->sbuf, p->slen, st, 1);
+		if ((*st & p->mask) == p->match)
+			return 1;
+		if (now_us() >= deadline)
+			return 0;
+	}
+}
+
+static void handle_poll_status(void)
+{
+	struct poll_spec p;
+	u8 st = 0xff;
+	int matched;
+
+	stats.ext_cmds++;
+	get_poll_spec(&p);
+	matched = poll_status(&p, &st);
+	ser_put(S_ACK);
+	ser_put(matched);
+	ser_put(st);
+}
+
+/*
+ * Run the ops of S_CMD_X_EXEC_POLL, or only skip them, appending what they
+ * read to rbuf at @rpos.
+ */
+static size_t exec_ops(size_t rpos, int run)
+{
+	u8 n = get_le(1);
+
+	while (n--) {
+		u32 slen = get_le(3);
+		u32 rlen = get_le(3);
+
+		if (rpos + rlen > sizeof(rbuf)) {
+			fprintf(stderr, "emu: exec_poll: too much data\n");
+			exit(1);
+		}
+		ser_read(sbuf, slen);
+		if (run) {
+			stats.spiops++;
+			nand_txn(sbuf, slen, rbuf + rpos, rlen);
+		} else {
+			memset(rbuf + rpos, 0xff, rlen);
+		}
+		rpos += rlen;
+	}
+	return rpos;
+}
+
+static void handle_exec_poll(void)
+{
+	struct poll_spec p;
+	u8 st = 0xff;
+	size_t rlen;
+	int matched;
+
+	stats.ext_cmds++;
+	rlen = exec_ops(0, 1);
+	get_poll_spec(&p);
+	matched = poll_status(&p, &st);
+	rlen = exec_ops(rlen, matched);
+	ser_put(S_ACK);
+	ser_put(matched);
+	ser_put(st);
+	ser_write(rbuf, rlen);
+}
+
+static void handle_page_crc32(void)
+{
+	static u8 lbuf[256], cbuf[256];
+	u32 count = get_le(2);
+	u32 llen, clen, rlen, addr, i;
+	struct poll_spec p;
+	int naddr, j;
+	u8 st;
+
+	stats.ext_cmds++;
+	llen = get_le(3);
+	get_le(3);
+	if (llen > sizeof(lbuf)) {
+		fprintf(stderr, "emu: page_crc32: load op too long\n");
+		exit(1);
+	}
+	ser_read(lbuf, llen);
+	get_poll_spec(&p);
+	clen = get_le(3);
+	rlen = get_le(3);
+	if (clen > sizeof(cbuf) || rlen > sizeof(rbuf)) {
+		fprintf(stderr, "emu: page_crc32: read op too long\n");
+		exit(1);
+	}
+	ser_read(cbuf, clen);
+
+	naddr = llen > 4 ? 4 : llen - 1;
+	addr = be_addr(lbuf + llen - naddr, naddr);
+	ser_put(S_ACK);
+	for (i = 0; i < count; i++) {
+		u32 crc = 0;
+
+		for (j = 0; j < naddr; j++)
+			lbuf[llen - 1 - j] = (addr + i) >> (8 * j);
+		stats.spiops++;
+		nand_txn(lbuf, llen, rbuf, 0);
+		st = 0xff;
+		if (poll_status(&p, &st)) {
+			stats.spiops++;
+			nand_txn(cbuf, clen, rbuf, rlen);
+			crc = crc32(0, rbuf, rlen);
+		}
+		ser_put(st);
+		put_le(crc, 4);
+	}
+}
+
+static void print_stats(void)
+{
+	fprintf(stderr,
+		"emu stats: cmds %llu spiops %llu ext %llu in %llu out %llu | "
+		"page_reads %llu cache_reads %llu programs %llu erases %llu | "
+		"busy_violations %llu plane_violations %llu reprograms %llu\n",
+		(unsigned long long)stats.cmds,
+		(unsigned long long)stats.spiops,
+		(unsigned long long)stats.ext_cmds,
+		(unsigned long long)stats.bytes_in,
+		(unsigned long long)stats.bytes_out,
+		(unsigned long long)stats.page_reads,
+		(unsigned long long)stats.cache_reads,
+		(unsigned long long)stats.programs,
+		(unsigned long long)stats.erases,
+		(unsigned long long)stats.busy_violations,
+		(unsigned long long)stats.plane_violations,
+		(unsigned long long)stats.reprograms);
+	memset(&stats, 0, sizeof(stats));
+}
+
+static void handle_cmd(u8 cmd)
+{
+	u32 v;
+
+	stats.cmds++;
+	switch (cmd) {
+	case S_CMD_NOP:
+		ser_put(S_ACK);
+		break;
+	case S_CMD_Q_IFACE:
+		ser_put(S_ACK);
+		put_le(1, 2);
+		break;
+	case S_CMD_Q_CMDMAP:
+		ser_put(S_ACK);
+		ser_write(cmdmap, sizeof(cmdmap));
+		break;
+	case S_CMD_Q_PGMNAME: {
+		char name[16] = "spi-nand-emu";
+
+		ser_put(S_ACK);
+		ser_write(name, sizeof(name));
+		break;
+	}
+	case S_CMD_Q_SERBUF:
+		ser_put(S_ACK);
+		put_le(serbuf_size, 2);
+		break;
+	case S_CMD_Q_BUSTYPE:
+		ser_put(S_ACK);
+		ser_put(0x08);
+		break;
+	case S_CMD_SYNCNOP:
+		ser_put(S_NAK);
+		ser_put(S_ACK);
+		break;
+	case S_CMD_S_BUSTYPE:
+		get_le(1);
+		ser_put(S_ACK);
+		break;
+	case S_CMD_O_SPIOP:
+		handle_spiop();
+		break;
+	case S_CMD_X_POLL_STATUS:
+		handle_poll_status();
+		break;
+	case S_CMD_X_EXEC_POLL:
+		handle_exec_poll();
+		break;
+	case S_CMD_X_PAGE_CRC32:
+		handle_page_crc32();
+		break;
+	case S_CMD_S_SPI_FREQ:
+		v = get_le(4);
+		if (v && v < spi_freq)
+			spi_freq = v;
+		ser_put(S_ACK);
+		put_le(spi_freq, 4);
+		break;
+	default:
+		fprintf(stderr, "emu: unsupported command 0x%02x\n", cmd);
+		ser_put(S_NAK);
+		break;
+	}
+}
+
+static void on_signal(int sig)
+{
+	if (sig == SIGUSR1) {
+		dump_stats = 1;
+		return;
+	}
+	print_stats();
+	_exit(0);
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"usage: %s [-m model] [-b bad,blocks] [-f fail_block] [-s scale]\n"
+		"          [-S serbuf] [-l link] [-X] [-v]\n"
+		" -m: simulated chip\n"
+		" -b: blocks marked bad, e.g. 3,17\n"
+		" -f: block whose first program fails\n"
+		" -s: busy time multiplier\n"
+		" -S: advertised serial buffer size\n"
+		" -l: symlink pointing to the pseudo terminal\n"
+		" -X: advertise the spi-nand-prog serprog extensions\n"
+		" -v: report every violation\n"
+		"models:", prog);
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+		fprintf(stderr, " %s", models[i].name);
+	fprintf(stderr, "\n");
+}
+
+static void mark_bad(unsigned int blk)
+{
+	unsigned int die = blk / model->blocks_per_die;
+	unsigned int row = (blk % model->blocks_per_die) << row_bits();
+	u8 *p = page_ptr(die, row, true);
+
+	p[model->pagesize] = 0;
+	p[model->pagesize + 1] = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *model_name = "W25N01GV";
+	const char *link = NULL;
+	char *badlist = NULL;
+	struct sigaction sa;
+	struct termios tty;
+	unsigned int i;
+	int opt, slave;
+	char *pts;
+
+	while ((opt = getopt(argc, argv, "m:b:f:s:l:S:vX")) >= 0) {
+		switch (opt) {
+		case 'm':
+			model_name = optarg;
+			break;
+		case 'b':
+			badlist = optarg;
+			break;
+		case 'f':
+			fail_block = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			t_scale = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			link = optarg;
+			break;
+		case 'S':
+			serbuf_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'X':
+			extensions = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+		if (!strcmp(models[i].name, model_name))
+			model = &models[i];
+	if (!model) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	blocks = calloc(model->blocks_per_die * model->ndies, sizeof(*blocks));
+	for (i = 0; i < model->ndies; i++) {
+		dies[i].cache = malloc(page_total());
+		memset(dies[i].cache, 0xff, page_total());
+		dies[i].cfg = model->cfg_default;
+		dies[i].lock = 0x7c;
+		dies[i].dreg_row = -1;
+		dies[i].cache_row = -1;
+	}
+
+	if (badlist) {
+		char *tok;
+
+		for (tok = strtok(badlist, ","); tok; tok = strtok(NULL, ","))
+			mark_bad(strtoul(tok, NULL, 0));
+	}
+
+	cmdmap_set(S_CMD_NOP);
+	cmdmap_set(S_CMD_Q_IFACE);
+	cmdmap_set(S_CMD_Q_CMDMAP);
+	cmdmap_set(S_CMD_Q_PGMNAME);
+	cmdmap_set(S_CMD_Q_SERBUF);
+	cmdmap_set(S_CMD_Q_BUSTYPE);
+	cmdmap_set(S_CMD_SYNCNOP);
+	cmdmap_set(S_CMD_S_BUSTYPE);
+	cmdmap_set(S_CMD_O_SPIOP);
+	cmdmap_set(S_CMD_S_SPI_FREQ);
+	if (extensions) {
+		cmdmap_set(S_CMD_X_POLL_STATUS);
+		cmdmap_set(S_CMD_X_EXEC_POLL);
+		cmdmap_set(S_CMD_X_PAGE_CRC32);
+	}
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)) {
+		perror("emu: pty");
+		return 1;
+	}
+	tcgetattr(fd, &tty);
+	cfmakeraw(&tty);
+	tcsetattr(fd, TCSANOW, &tty);
+
+	pts = ptsname(fd);
+	/* Keep the slave open so that clients may come and go. */
+	slave = open(pts, O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror("emu: open slave");
+		return 1;
+	}
+	tcgetattr(slave, &tty);
+	cfmakeraw(&tty);
+	tcsetattr(slave, TCSANOW, &tty);
+
+	if (link) {
+		unlink(link);
+		if (symlink(pts, link)) {
+			perror("emu: symlink");
+			return 1;
+		}
+	}
+
+	printf("%s\n", pts);
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	for (;;) {
+		u8 cmd;
+
+		if (dump_stats) {
+			dump_stats = 0;
+			print_stats();
+		}
+		while (rxhead == rxtail) {
+			ser_fill();
+			if (dump_stats) {
+				dump_stats = 0;
+				print_stats();
+			}
+		}
+		ser_read(&cmd, 1);
+		handle_cmd(cmd);
+		if (rxhead == rxtail)
+			ser_flush();
+	}
+
+	return 0;
+}